@@ -26,7 +26,7 @@ conf_ldflags = -s
 EOT
 
 echo "Building ninja manually..."
-srcs=$(ls src/*.cc | grep -v test)
+srcs=$(ls src/*.cc | grep -v test | grep -v ninja_worker)
 g++ -Wno-deprecated -o ninja.bootstrap $srcs
 
 echo "Building ninja using itself..."
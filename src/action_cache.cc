@@ -0,0 +1,437 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <algorithm>
+
+#include "graph.h"
+#include "ninja.h"
+#include "parsers.h"
+
+namespace {
+
+// Results kept per action; older ones are dropped.
+const size_t kMaxResults = 4;
+
+inline uint64_t Rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// MurmurHash3 (x64, 128 bits) of |data|, in hex.  It isn't a
+// cryptographic hash, but nobody is trying to forge entries in their own
+// build cache, and it hashes several GB/s.
+string HashBytes(const string& data) {
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+  uint64_t h1 = 0, h2 = 0;
+  size_t len = data.size();
+  size_t blocks = len / 16;
+  for (size_t i = 0; i <= blocks; ++i) {
+    uint64_t k[2] = { 0, 0 };
+    if (i < blocks) {
+      memcpy(k, data.data() + i * 16, 16);
+    } else {
+      // The tail, zero-padded; mixing in zero words is a no-op, which
+      // matches the reference implementation.
+      memcpy(k, data.data() + i * 16, len & 15);
+    }
+    uint64_t k1 = k[0], k2 = k[1];
+    k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    if (i < blocks) {
+      h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+      h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+  }
+  h1 ^= len;
+  h2 ^= len;
+  h1 += h2;
+  h2 += h1;
+  h1 = Fmix64(h1);
+  h2 = Fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+
+  char buf[33];
+  snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h1,
+           (unsigned long long)h2);
+  return buf;
+}
+
+bool WriteFile(const string& path, const string& contents) {
+  FILE* f = fopen(path.c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(contents.data(), 1, contents.size(), f) ==
+      contents.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+    unlink(path.c_str());
+  return ok;
+}
+
+// Write |contents| to |path| so that readers see either the old file or
+// the new one.
+bool ReplaceFile(const string& path, const string& contents) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".tmp%d", (int)getpid());
+  string tmp = path + suffix;
+  if (!WriteFile(tmp, contents))
+    return false;
+  if (rename(tmp.c_str(), path.c_str()) < 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Make |to| a reflink of |from| if the filesystem supports it.
+bool Reflink(const string& from, const string& to) {
+#ifdef FICLONE
+  int in = open(from.c_str(), O_RDONLY);
+  if (in < 0)
+    return false;
+  int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+  bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+  if (out >= 0)
+    close(out);
+  close(in);
+  if (cloned)
+    return true;
+  unlink(to.c_str());
+#endif
+  return false;
+}
+
+// Make |to| a copy of |from|, with the same permissions: a reflink if the
+// filesystem supports them, else a real copy.
+bool CloneFile(const string& from, const string& to) {
+  struct stat st;
+  if (stat(from.c_str(), &st) < 0)
+    return false;
+  unlink(to.c_str());
+  if (!Reflink(from, to)) {
+    string contents, err;
+    if (ReadFile(from, &contents, &err) < 0 || !WriteFile(to, contents))
+      return false;
+  }
+  chmod(to.c_str(), st.st_mode & 07777);
+  return true;
+}
+
+struct CacheFile {
+  string path;
+  long long size;
+  long long mtime_ns;
+  bool operator<(const CacheFile& other) const {
+    return mtime_ns < other.mtime_ns;
+  }
+};
+
+void ListFiles(const string& dir, vector<CacheFile>* files) {
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (dirent* ent = readdir(d)) {
+    if (ent->d_name[0] == '.')
+      continue;
+    CacheFile file;
+    file.path = dir + "/" + ent->d_name;
+    struct stat st;
+    if (stat(file.path.c_str(), &st) < 0)
+      continue;
+    file.size = st.st_size;
+    file.mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL +
+        st.st_mtim.tv_nsec;
+    files->push_back(file);
+  }
+  closedir(d);
+}
+
+}  // anonymous namespace
+
+bool ActionCache::Open(const string& dir, long long max_size, string* err) {
+  dir_ = dir;
+  max_size_ = max_size;
+  const char* subdirs[] = { "", "/objects", "/actions" };
+  for (int i = 0; i < 3; ++i) {
+    string path = dir + subdirs[i];
+    if (mkdir(path.c_str(), 0777) < 0 && errno != EEXIST) {
+      *err = "mkdir(" + path + "): " + strerror(errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+string ActionCache::HashFile(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0)
+    return "-";
+  long long mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL +
+      st.st_mtim.tv_nsec;
+  hash_map<string, FileHash>::iterator i = file_hashes_.find(path);
+  if (i != file_hashes_.end() && i->second.ino_ == (long long)st.st_ino &&
+      i->second.size_ == st.st_size && i->second.mtime_ns_ == mtime_ns) {
+    return i->second.hash_;
+  }
+
+  string contents, err;
+  if (ReadFile(path, &contents, &err) < 0)
+    return "-";
+  FileHash hash;
+  hash.ino_ = st.st_ino;
+  hash.size_ = st.st_size;
+  hash.mtime_ns_ = mtime_ns;
+  hash.hash_ = HashBytes(contents);
+  file_hashes_[path] = hash;
+  return hash.hash_;
+}
+
+string ActionCache::ActionKey(Edge* edge) {
+  if (edge->is_phony())
+    return "";
+  string key = edge->EvaluateCommand();
+  key.push_back('\0');
+  int explicit_deps = edge->inputs_.size() - edge->implicit_deps_ -
+      edge->order_only_deps_;
+  for (int i = 0; i < explicit_deps; ++i) {
+    const string& path = edge->inputs_[i]->file_->path_;
+    string hash = HashFile(path);
+    if (hash == "-")
+      return "";
+    key += path + '\0' + hash + '\0';
+  }
+  for (vector<Node*>::iterator i = edge->outputs_.begin();
+       i != edge->outputs_.end(); ++i) {
+    key += (*i)->file_->path_ + '\0';
+  }
+  return HashBytes(key);
+}
+
+bool ActionCache::LoadResults(const string& key, vector<Result>* results) {
+  string contents, err;
+  if (ReadFile(dir_ + "/actions/" + key, &contents, &err) < 0)
+    return false;
+
+  // "result MS" (just "result" if the time isn't known), then one
+  // "dep HASH PATH" or "out HASH PATH" line for each file, per result.
+  size_t pos = 0;
+  while (pos < contents.size()) {
+    size_t end = contents.find('\n', pos);
+    if (end == string::npos)
+      return false;
+    string line = contents.substr(pos, end - pos);
+    pos = end + 1;
+    if (line.compare(0, 6, "result") == 0) {
+      results->push_back(Result());
+      if (line.size() > 7)
+        results->back().time_ms_ = atoi(line.c_str() + 7);
+      continue;
+    }
+    size_t space = line.find(' ', 4);
+    if (results->empty() || line.size() < 4 || space == string::npos)
+      return false;
+    pair<string, string> file(line.substr(space + 1),
+                              line.substr(4, space - 4));
+    if (line.compare(0, 4, "dep ") == 0)
+      results->back().deps_.push_back(file);
+    else if (line.compare(0, 4, "out ") == 0)
+      results->back().outputs_.push_back(file);
+    else
+      return false;
+  }
+  return true;
+}
+
+bool ActionCache::SaveResults(const string& key,
+                              const vector<Result>& results) {
+  string contents;
+  for (vector<Result>::const_iterator r = results.begin();
+       r != results.end(); ++r) {
+    contents += "result";
+    if (r->time_ms_ >= 0) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), " %d", r->time_ms_);
+      contents += buf;
+    }
+    contents += "\n";
+    for (vector<pair<string, string> >::const_iterator i = r->deps_.begin();
+         i != r->deps_.end(); ++i) {
+      contents += "dep " + i->second + " " + i->first + "\n";
+    }
+    for (vector<pair<string, string> >::const_iterator i =
+             r->outputs_.begin(); i != r->outputs_.end(); ++i) {
+      contents += "out " + i->second + " " + i->first + "\n";
+    }
+  }
+  return ReplaceFile(dir_ + "/actions/" + key, contents);
+}
+
+bool ActionCache::AddObject(const string& path, const string& hash) {
+  string object = dir_ + "/objects/" + hash;
+  if (access(object.c_str(), F_OK) == 0)
+    return true;
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".tmp%d", (int)getpid());
+  string tmp = object + suffix;
+  if (!CloneFile(path, tmp))
+    return false;
+  if (rename(tmp.c_str(), object.c_str()) < 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ActionCache::Restore(Edge* edge, int* time_ms) {
+  string key = ActionKey(edge);
+  vector<Result> results;
+  if (key.empty() || !LoadResults(key, &results)) {
+    ++misses_;
+    return false;
+  }
+
+  for (vector<Result>::iterator r = results.begin(); r != results.end();
+       ++r) {
+    bool match = true;
+    for (vector<pair<string, string> >::iterator i = r->deps_.begin();
+         i != r->deps_.end() && match; ++i) {
+      match = HashFile(i->first) == i->second;
+    }
+    if (!match)
+      continue;
+
+    for (vector<pair<string, string> >::iterator i = r->outputs_.begin();
+         i != r->outputs_.end() && match; ++i) {
+      string object = dir_ + "/objects/" + i->second;
+      match = CloneFile(object, i->first);
+      // Mark the object as recently used, and make the output newer than
+      // its inputs.
+      utimes(object.c_str(), NULL);
+      utimes(i->first.c_str(), NULL);
+    }
+    if (!match)
+      break;  // Evicted; the command will overwrite what we restored.
+    utimes((dir_ + "/actions/" + key).c_str(), NULL);
+    if (time_ms)
+      *time_ms = r->time_ms_;
+    ++hits_;
+    return true;
+  }
+  ++misses_;
+  return false;
+}
+
+void ActionCache::Store(Edge* edge, int time_ms) {
+  string key = ActionKey(edge);
+  if (key.empty())
+    return;
+
+  Result result;
+  result.time_ms_ = time_ms;
+  // The implicit inputs ninja knew about when it started the command...
+  int explicit_deps = edge->inputs_.size() - edge->implicit_deps_ -
+      edge->order_only_deps_;
+  vector<string> deps;
+  for (int i = explicit_deps; i < explicit_deps + edge->implicit_deps_; ++i)
+    deps.push_back(edge->inputs_[i]->file_->path_);
+  // ...and those the command says it read this time.
+  string depfile = edge->EvaluateDepFile();
+  if (!depfile.empty()) {
+    string contents, err;
+    MakefileParser makefile;
+    if (ReadFile(depfile, &contents, &err) < 0 ||
+        !makefile.Parse(contents, &err)) {
+      return;
+    }
+    deps.insert(deps.end(), makefile.ins_.begin(), makefile.ins_.end());
+  }
+  sort(deps.begin(), deps.end());
+  deps.erase(unique(deps.begin(), deps.end()), deps.end());
+  for (vector<string>::iterator i = deps.begin(); i != deps.end(); ++i)
+    result.deps_.push_back(make_pair(*i, HashFile(*i)));
+
+  vector<string> outputs;
+  for (vector<Node*>::iterator i = edge->outputs_.begin();
+       i != edge->outputs_.end(); ++i) {
+    outputs.push_back((*i)->file_->path_);
+  }
+  if (!depfile.empty())
+    outputs.push_back(depfile);
+  for (vector<string>::iterator i = outputs.begin(); i != outputs.end();
+       ++i) {
+    string hash = HashFile(*i);
+    if (hash == "-" || !AddObject(*i, hash))
+      return;
+    result.outputs_.push_back(make_pair(*i, hash));
+  }
+
+  vector<Result> results;
+  LoadResults(key, &results);
+  results.insert(results.begin(), result);
+  if (results.size() > kMaxResults)
+    results.resize(kMaxResults);
+  if (SaveResults(key, results))
+    ++stores_;
+}
+
+int ActionCache::Trim() {
+  vector<CacheFile> files;
+  ListFiles(dir_ + "/objects", &files);
+  ListFiles(dir_ + "/actions", &files);
+  long long size = 0;
+  for (vector<CacheFile>::iterator i = files.begin(); i != files.end(); ++i)
+    size += i->size;
+  if (size <= max_size_)
+    return 0;
+
+  // Go a little below the limit, so that we don't trim after every build.
+  long long target = max_size_ - max_size_ / 10;
+  sort(files.begin(), files.end());
+  int removed = 0;
+  for (vector<CacheFile>::iterator i = files.begin();
+       i != files.end() && size > target; ++i) {
+    if (unlink(i->path.c_str()) == 0) {
+      size -= i->size;
+      ++removed;
+    }
+  }
+  return removed;
+}
@@ -0,0 +1,95 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_ACTION_CACHE_H_
+#define NINJA_ACTION_CACHE_H_
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "hash_map.h"
+
+struct Edge;
+
+// Remembers the outputs of commands so that running the same command on
+// the same inputs again can be skipped.
+//
+// The cache directory holds:
+//   objects/HASH  output files, named by the hash of their contents
+//   actions/KEY   results for the command whose key is KEY
+// KEY hashes the command line and the paths and contents of the explicit
+// inputs.  The implicit inputs, including those from the depfile, can
+// differ between runs of the same command (e.g. a header included on one
+// branch but not another), so each action file lists a few recent
+// results, each with the implicit inputs it read and their hashes; a
+// result is only used if those files still have the same contents.
+//
+// Outputs are restored as reflinks where the filesystem supports them and
+// as copies otherwise, never as hard links: anything may later rewrite an
+// output in place, and that mustn't change the cached copy.
+struct ActionCache {
+  ActionCache() : max_size_(0), hits_(0), misses_(0), stores_(0) {}
+
+  // Use |dir| as the cache, creating it if necessary, and keep it under
+  // |max_size| bytes.
+  bool Open(const string& dir, long long max_size, string* err);
+
+  // If |edge| has a cached result, put its outputs (and depfile) in place
+  // and return true.  Sets |time_ms| (if not NULL) to how long the command
+  // took when it ran, or -1 if that isn't known.
+  bool Restore(Edge* edge, int* time_ms = NULL);
+  // Save the outputs |edge| just produced, in a run taking |time_ms|.
+  void Store(Edge* edge, int time_ms = -1);
+  // Evict the least recently used files until the cache fits in its
+  // size limit again.  Returns the number of files removed.
+  int Trim();
+
+  // Hex hash of |path|'s contents, or "-" if it doesn't exist.
+  string HashFile(const string& path);
+
+  struct Result {
+    Result() : time_ms_(-1) {}
+    // How long the command took, or -1 if unknown.
+    int time_ms_;
+    // Implicit inputs and their hashes.
+    vector<pair<string, string> > deps_;
+    // Outputs and their hashes.
+    vector<pair<string, string> > outputs_;
+  };
+  // Key for |edge|, or "" if it can't be cached.
+  string ActionKey(Edge* edge);
+  bool LoadResults(const string& key, vector<Result>* results);
+  bool SaveResults(const string& key, const vector<Result>& results);
+  // Put a copy of |path|'s contents, which hash to |hash|, in objects/.
+  bool AddObject(const string& path, const string& hash);
+
+  string dir_;
+  long long max_size_;
+  int hits_;
+  int misses_;
+  int stores_;
+
+  // Hashes already computed, by path.  Each is checked against the file's
+  // inode, size and mtime before it is reused.
+  struct FileHash {
+    long long ino_;
+    long long size_;
+    long long mtime_ns_;
+    string hash_;
+  };
+  hash_map<string, FileHash> file_hashes_;
+};
+
+#endif  // NINJA_ACTION_CACHE_H_
@@ -0,0 +1,198 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+
+// Runs in a scratch directory, with the cache in its "cache"
+// subdirectory.  Commands are never run; tests write the outputs
+// themselves.
+struct ActionCacheTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    char dir[] = "/tmp/ninja_action_cache_test-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    ASSERT_TRUE(getcwd(old_cwd_, sizeof(old_cwd_)) != NULL);
+    ASSERT_EQ(0, chdir(dir));
+    string err;
+    ASSERT_TRUE(cache_.Open("cache", 1 << 20, &err)) << err;
+
+    AssertParse(&state_,
+"rule cc\n"
+"  command = cc $in > $out\n"
+"  depfile = $out.d\n"
+"build out: cat in\n"
+"build out.o: cc in.c\n");
+  }
+
+  virtual void TearDown() {
+    ASSERT_EQ(0, chdir(old_cwd_));
+    system(("rm -rf " + dir_).c_str());
+  }
+
+  void Write(const string& path, const string& contents) {
+    FILE* f = fopen(path.c_str(), "w");
+    ASSERT_TRUE(f != NULL);
+    fputs(contents.c_str(), f);
+    fclose(f);
+  }
+
+  string Read(const string& path) {
+    string contents, err;
+    ReadFile(path, &contents, &err);
+    return contents;
+  }
+
+  Edge* EdgeFor(const string& output) {
+    return GetNode(output)->in_edge_;
+  }
+
+  ActionCache cache_;
+  string dir_;
+  char old_cwd_[1024];
+};
+
+TEST_F(ActionCacheTest, MissThenHit) {
+  Write("in", "hello\n");
+  EXPECT_FALSE(cache_.Restore(EdgeFor("out")));
+  EXPECT_EQ(1, cache_.misses_);
+
+  // "Run" the command, and cache the result.
+  Write("out", "hello\n");
+  cache_.Store(EdgeFor("out"));
+  EXPECT_EQ(1, cache_.stores_);
+
+  unlink("out");
+  EXPECT_TRUE(cache_.Restore(EdgeFor("out")));
+  EXPECT_EQ(1, cache_.hits_);
+  EXPECT_EQ("hello\n", Read("out"));
+  struct stat in_st, out_st;
+  ASSERT_EQ(0, stat("in", &in_st));
+  ASSERT_EQ(0, stat("out", &out_st));
+  EXPECT_GE(out_st.st_mtime, in_st.st_mtime);
+
+  // Different input contents are a different action.
+  Write("in", "goodbye\n");
+  EXPECT_FALSE(cache_.Restore(EdgeFor("out")));
+  // Going back finds the old result again.
+  Write("in", "hello\n");
+  EXPECT_TRUE(cache_.Restore(EdgeFor("out")));
+}
+
+TEST_F(ActionCacheTest, MissingInput) {
+  EXPECT_FALSE(cache_.Restore(EdgeFor("out")));
+  Write("out", "x");
+  cache_.Store(EdgeFor("out"));
+  EXPECT_EQ(0, cache_.stores_);
+}
+
+TEST_F(ActionCacheTest, DepfileDeps) {
+  // Two "branches" where in.c includes different headers.
+  Write("in.c", "#include <a.h>\n");
+  Write("a.h", "a1\n");
+  Write("b.h", "b1\n");
+  Write("out.o", "object a\n");
+  Write("out.o.d", "out.o: in.c a.h\n");
+  cache_.Store(EdgeFor("out.o"));
+  Write("in.c", "#include <b.h>\n");
+  Write("out.o", "object b\n");
+  Write("out.o.d", "out.o: in.c b.h\n");
+  cache_.Store(EdgeFor("out.o"));
+
+  Write("in.c", "#include <a.h>\n");
+  ASSERT_TRUE(cache_.Restore(EdgeFor("out.o")));
+  EXPECT_EQ("object a\n", Read("out.o"));
+  // The depfile comes back too.
+  EXPECT_EQ("out.o: in.c a.h\n", Read("out.o.d"));
+
+  // A header the command read has changed.
+  Write("a.h", "a2\n");
+  EXPECT_FALSE(cache_.Restore(EdgeFor("out.o")));
+  // A header it didn't read doesn't matter.
+  Write("a.h", "a1\n");
+  Write("b.h", "b2\n");
+  EXPECT_TRUE(cache_.Restore(EdgeFor("out.o")));
+}
+
+TEST_F(ActionCacheTest, KeepsPermissions) {
+  Write("in", "#!/bin/sh\n");
+  Write("out", "#!/bin/sh\n");
+  chmod("out", 0755);
+  cache_.Store(EdgeFor("out"));
+  unlink("out");
+  ASSERT_TRUE(cache_.Restore(EdgeFor("out")));
+  struct stat st;
+  ASSERT_EQ(0, stat("out", &st));
+  EXPECT_EQ(0755, st.st_mode & 0777);
+}
+
+TEST_F(ActionCacheTest, Trim) {
+  string big(200 << 10, 'x');
+  for (int i = 0; i < 8; ++i) {
+    big[0] = 'a' + i;
+    Write("in", big);
+    Write("out", big);
+    cache_.Store(EdgeFor("out"));
+  }
+  // 8 * 200k is over the 1M limit; the oldest entries go.
+  EXPECT_GT(cache_.Trim(), 0);
+  EXPECT_EQ(0, cache_.Trim());
+
+  // What is left still restores, and what was evicted is a miss.
+  unlink("out");
+  EXPECT_TRUE(cache_.Restore(EdgeFor("out")));
+  EXPECT_EQ(big, Read("out"));
+}
+
+TEST_F(ActionCacheTest, RestoresCopies) {
+  Write("in", "hello\n");
+  Write("out", "hello\n");
+  cache_.Store(EdgeFor("out"));
+  unlink("out");
+  ASSERT_TRUE(cache_.Restore(EdgeFor("out")));
+  struct stat st;
+  ASSERT_EQ(0, stat("out", &st));
+  EXPECT_EQ(1u, st.st_nlink);
+
+  // Rewriting the restored output in place leaves the cache alone.
+  FILE* f = fopen("out", "r+");
+  ASSERT_TRUE(f != NULL);
+  fputs("HELLO\n", f);
+  fclose(f);
+  unlink("out");
+  EXPECT_TRUE(cache_.Restore(EdgeFor("out")));
+  EXPECT_EQ("hello\n", Read("out"));
+}
+
+TEST_F(ActionCacheTest, KeepsTime) {
+  Write("in", "hello\n");
+  Write("out", "hello\n");
+  cache_.Store(EdgeFor("out"), 1234);
+  int time_ms = 0;
+  ASSERT_TRUE(cache_.Restore(EdgeFor("out"), &time_ms));
+  EXPECT_EQ(1234, time_ms);
+
+  // Results stored without a time still restore.
+  Write("in", "bye\n");
+  Write("out", "bye\n");
+  cache_.Store(EdgeFor("out"));
+  ASSERT_TRUE(cache_.Restore(EdgeFor("out"), &time_ms));
+  EXPECT_EQ(-1, time_ms);
+}
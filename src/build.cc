@@ -14,13 +14,112 @@
 
 #include "build.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/time.h>
+#include <unistd.h>
 
+#include "action_cache.h"
 #include "build_log.h"
 #include "graph.h"
+#include "jobserver.h"
 #include "ninja.h"
+#include "remote.h"
 #include "subprocess.h"
+#include "trace.h"
+#include "util.h"
+
+namespace {
+
+int ElapsedMs(const timeval& start, const timeval& end) {
+  timeval delta;
+  timersub(&end, &start, &delta);
+  return (delta.tv_sec * 1000) + (delta.tv_usec / 1000);
+}
+
+// Whether a write to stdout would go through now, rather than wait for
+// the terminal to drain.
+bool StdoutWritable() {
+  pollfd pfd = { 1, POLLOUT, 0 };
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLOUT);
+}
+
+int TerminalWidth() {
+  winsize size;
+  if (ioctl(1, TIOCGWINSZ, &size) < 0 || size.ws_col == 0)
+    return 80;
+  return size.ws_col;
+}
+
+// Format |ms| as e.g. "45s", "1m05s" or "2h10m", rounding down.
+string FormatDuration(long long ms) {
+  int seconds = ms / 1000;
+  char buf[32];
+  if (seconds >= 3600) {
+    snprintf(buf, sizeof(buf), "%dh%02dm", seconds / 3600,
+             (seconds / 60) % 60);
+  } else if (seconds >= 60) {
+    snprintf(buf, sizeof(buf), "%dm%02ds", seconds / 60, seconds % 60);
+  } else {
+    snprintf(buf, sizeof(buf), "%ds", seconds);
+  }
+  return buf;
+}
+
+// Set by SIGUSR1 while Builder::Build() runs.
+volatile sig_atomic_t g_dump_requested = 0;
+
+void RequestDump(int) {
+  g_dump_requested = 1;
+}
+
+// Set to the signal that asked Builder::Build() to stop.
+volatile sig_atomic_t g_interrupted = 0;
+
+void RequestInterrupt(int sig) {
+  g_interrupted = sig;
+}
+
+// Catches SIGINT, SIGTERM and SIGHUP for as long as it's in scope.  The
+// commands run in their own process groups, so they don't get these from
+// the terminal; Build() passes them on.
+struct ScopedInterruptSignals {
+  ScopedInterruptSignals() {
+    g_interrupted = 0;
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = RequestInterrupt;
+    for (int i = 0; i < 3; ++i)
+      sigaction(kSignals[i], &act, &old_acts_[i]);
+  }
+  ~ScopedInterruptSignals() {
+    for (int i = 0; i < 3; ++i)
+      sigaction(kSignals[i], &old_acts_[i], NULL);
+  }
+  static const int kSignals[3];
+  struct sigaction old_acts_[3];
+};
+const int ScopedInterruptSignals::kSignals[3] = { SIGINT, SIGTERM, SIGHUP };
+
+// Handles SIGUSR1 for as long as it's in scope.
+struct ScopedDumpSignal {
+  ScopedDumpSignal() {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = RequestDump;
+    sigaction(SIGUSR1, &act, &old_act_);
+  }
+  ~ScopedDumpSignal() {
+    sigaction(SIGUSR1, &old_act_, NULL);
+  }
+  struct sigaction old_act_;
+};
+
+}  // anonymous namespace
 
 struct BuildStatus {
   BuildStatus();
@@ -30,21 +129,70 @@ struct BuildStatus {
   int BuildEdgeFinished(Edge* edge);
 
   void PrintStatus(Edge* edge);
+  // Draw the status line if it is out of date, and either |force| is set
+  // or the last one was drawn long enough ago.  A terminal that isn't
+  // keeping up gets its frames dropped rather than holding up the build.
+  void RedrawStatus(bool force);
+  // Milliseconds until a held-back status line is due, or -1 if there
+  // is none.
+  int MsUntilRedraw();
+
+  // If no command has finished for stall_report_ms_, say which have been
+  // running longest.
+  void ReportStall();
+  // Milliseconds until ReportStall() would have something to say, or -1.
+  int MsUntilStallReport();
+  // List up to |limit| running commands, longest running first, with how
+  // long each took the last time it ran.
+  void PrintRunning(size_t limit);
+  // Start a fresh line for output that isn't the status line.
+  void EndStatusLine();
+
+  // Estimate the time left in the build, in ms, or -1 if there is no
+  // logged timing data to go on.
+  long long EstimateRemainingMs(const timeval& now);
+  // Format " ETA 1m05s" for the status line, or "" if there's no estimate.
+  string FormatEta();
 
   time_t last_update_;
   int finished_edges_, total_edges_;
 
+  // The plan being executed and how many jobs run at once, for the ETA.
+  const Plan* plan_;
+  int parallelism_;
+
   typedef map<Edge*, timeval> RunningEdgeMap;
   RunningEdgeMap running_edges_;
 
+  // Where to record finished commands, if anywhere.
+  Trace* trace_;
+
   BuildConfig::Verbosity verbosity_;
   // Whether we can do fancy terminal control codes.
   bool smart_terminal_;
+
+  // The latest description for the smart terminal's status line, and
+  // whether it has changed since it was drawn.
+  string status_;
+  bool status_dirty_;
+  timeval last_redraw_;
+  // Minimum time between redraws; 0 redraws on every change.
+  int redraw_interval_ms_;
+
+  // When a command last finished (or the last stall report).
+  timeval last_progress_;
+  int stall_report_ms_;
+  // For the last run times of running commands, if set.
+  BuildLog* log_;
 };
 
 BuildStatus::BuildStatus()
     : last_update_(time(NULL)), finished_edges_(0), total_edges_(0),
-      verbosity_(BuildConfig::NORMAL) {
+      plan_(NULL), parallelism_(1), trace_(NULL),
+      verbosity_(BuildConfig::NORMAL), status_dirty_(false),
+      redraw_interval_ms_(0), stall_report_ms_(0), log_(NULL) {
+  timerclear(&last_redraw_);
+  gettimeofday(&last_progress_, NULL);
   const char* term = getenv("TERM");
   smart_terminal_ = isatty(1) && term && string(term) != "dumb";
 }
@@ -65,27 +213,36 @@ int BuildStatus::BuildEdgeFinished(Edge* edge) {
   timeval now;
   gettimeofday(&now, NULL);
   ++finished_edges_;
+  last_progress_ = now;
+
+  RunningEdgeMap::iterator i = running_edges_.find(edge);
+  int ms = ElapsedMs(i->second, now);
+  if (trace_) {
+    string name = edge->GetDescription();
+    if (name.empty())
+      name = edge->outputs_[0]->file_->path_;
+    trace_->AddCommand(name, edge->EvaluateCommand(),
+                       trace_->ToTraceTime(i->second),
+                       trace_->ToTraceTime(now));
+  }
+  running_edges_.erase(i);
 
   if (verbosity_ != BuildConfig::QUIET) {
     if (smart_terminal_ && verbosity_ == BuildConfig::NORMAL) {
       PrintStatus(edge);
-      if (finished_edges_ == total_edges_)
+      if (finished_edges_ == total_edges_) {
+        RedrawStatus(true);
         printf("\n");
+      }
     } else {
       if (now.tv_sec - last_update_ > 5) {
-        printf("%.1f%% %d/%d\n", finished_edges_ * 100 / (float)total_edges_,
-               finished_edges_, total_edges_);
+        printf("%.1f%% %d/%d%s\n", finished_edges_ * 100 / (float)total_edges_,
+               finished_edges_, total_edges_, FormatEta().c_str());
         last_update_ = now.tv_sec;
       }
     }
   }
 
-  RunningEdgeMap::iterator i = running_edges_.find(edge);
-  timeval delta;
-  timersub(&now, &i->second, &delta);
-  int ms = (delta.tv_sec * 1000) + (delta.tv_usec / 1000);
-  running_edges_.erase(i);
-
   return ms;
 }
 
@@ -95,6 +252,10 @@ void BuildStatus::PrintStatus(Edge* edge) {
     return;
 
   case BuildConfig::VERBOSE:
+    if (Pool* pool = edge->pool_) {
+      printf("[pool %s %d/%d] ", pool->name_.c_str(), pool->current_use_,
+             pool->depth_);
+    }
     printf("%s\n", edge->EvaluateCommand().c_str());
     break;
 
@@ -104,9 +265,9 @@ void BuildStatus::PrintStatus(Edge* edge) {
       to_print = edge->EvaluateCommand();
 
     if (smart_terminal_) {
-      printf("\r[%d/%d] %s\e[K", finished_edges_, total_edges_,
-             to_print.c_str());
-      fflush(stdout);
+      status_ = to_print;
+      status_dirty_ = true;
+      RedrawStatus(false);
     } else {
       printf("%s\n", to_print.c_str());
     }
@@ -114,89 +275,368 @@ void BuildStatus::PrintStatus(Edge* edge) {
   }
 }
 
-Plan::Plan() : command_edges_(0) {}
+void BuildStatus::RedrawStatus(bool force) {
+  if (!status_dirty_)
+    return;
+  timeval now;
+  gettimeofday(&now, NULL);
+  if (!force) {
+    if (ElapsedMs(last_redraw_, now) < redraw_interval_ms_)
+      return;
+    if (!StdoutWritable()) {
+      // Drop this frame and try again after another interval.
+      last_redraw_ = now;
+      return;
+    }
+  }
+
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "[%d/%d%s] ", finished_edges_,
+           total_edges_, FormatEta().c_str());
+  string line = string("\r") + prefix;
+  // Keep to one row, so that the next "\r" returns to its start.
+  int room = TerminalWidth() - (int)strlen(prefix);
+  if (room > 0)
+    line += ElideMiddle(status_, room);
+  line += "\e[K";
+
+  // Anything printed before has to come out first.  This, and the write
+  // below, can still block if the terminal fills up partway; only
+  // starting a redraw is skipped while it is busy.
+  fflush(stdout);
+  const char* data = line.data();
+  size_t left = line.size();
+  while (left > 0) {
+    ssize_t len = write(1, data, left);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    data += len;
+    left -= len;
+  }
+  status_dirty_ = false;
+  last_redraw_ = now;
+}
+
+int BuildStatus::MsUntilRedraw() {
+  if (!status_dirty_)
+    return -1;
+  timeval now;
+  gettimeofday(&now, NULL);
+  return max(redraw_interval_ms_ - ElapsedMs(last_redraw_, now), 0);
+}
+
+void BuildStatus::ReportStall() {
+  if (MsUntilStallReport() != 0)
+    return;
+  timeval now;
+  gettimeofday(&now, NULL);
+  EndStatusLine();
+  printf("ninja: no command finished in the last %s; still waiting for:\n",
+         FormatDuration(ElapsedMs(last_progress_, now)).c_str());
+  PrintRunning(3);
+  last_progress_ = now;
+}
+
+int BuildStatus::MsUntilStallReport() {
+  if (stall_report_ms_ <= 0 || running_edges_.empty() ||
+      verbosity_ == BuildConfig::QUIET) {
+    return -1;
+  }
+  timeval now;
+  gettimeofday(&now, NULL);
+  return max(stall_report_ms_ - ElapsedMs(last_progress_, now), 0);
+}
+
+void BuildStatus::PrintRunning(size_t limit) {
+  timeval now;
+  gettimeofday(&now, NULL);
+  vector<pair<int, Edge*> > running;
+  for (RunningEdgeMap::iterator i = running_edges_.begin();
+       i != running_edges_.end(); ++i) {
+    running.push_back(make_pair(ElapsedMs(i->second, now), i->first));
+  }
+  sort(running.rbegin(), running.rend());
+
+  for (size_t i = 0; i < running.size() && i < limit; ++i) {
+    Edge* edge = running[i].second;
+    string description = edge->GetDescription();
+    if (description.empty() || verbosity_ == BuildConfig::VERBOSE)
+      description = edge->EvaluateCommand();
+    string last;
+    if (BuildLog::LogEntry* entry = log_ ?
+        log_->LookupByOutput(edge->outputs_[0]->file_->path_) : NULL) {
+      last = " (last took " + FormatDuration(entry->time_ms) + ")";
+    }
+    printf("  %6s %s%s\n", FormatDuration(running[i].first).c_str(),
+           description.c_str(), last.c_str());
+  }
+  if (running.size() > limit)
+    printf("  and %d more\n", (int)(running.size() - limit));
+}
+
+void BuildStatus::EndStatusLine() {
+  if (!smart_terminal_ || status_.empty())
+    return;
+  printf("\n");
+  // Draw it again below what is printed now.
+  status_dirty_ = true;
+}
+
+long long BuildStatus::EstimateRemainingMs(const timeval& now) {
+  if (!plan_ || !plan_->has_timings())
+    return -1;
+
+  // Two lower bounds on the time left: the remaining work spread over
+  // every job slot, and the longest chain of steps that must run one
+  // after another.  Running edges count only for the part of their
+  // estimate they haven't used yet.
+  long long work = plan_->remaining_time_ms();
+  long long critical = plan_->ready_critical_time_ms();
+  for (RunningEdgeMap::iterator i = running_edges_.begin();
+       i != running_edges_.end(); ++i) {
+    long long elapsed = ElapsedMs(i->second, now);
+    Edge* edge = i->first;
+    work -= min(elapsed, (long long)edge->estimate_ms_);
+    critical = max(critical, edge->critical_time_ms_ - elapsed);
+  }
+  if (work < 0)
+    work = 0;
+  return max(work / max(parallelism_, 1), critical);
+}
+
+string BuildStatus::FormatEta() {
+  timeval now;
+  gettimeofday(&now, NULL);
+  long long ms = EstimateRemainingMs(now);
+  if (ms < 0)
+    return "";
+  return " ETA " + FormatDuration(ms + 999);
+}
+
+Plan::Plan()
+    : wanted_edges_(0), command_edges_(0), has_timings_(false),
+      remaining_time_ms_(0) {}
 
 bool Plan::AddTarget(Node* node, string* err) {
-  vector<Node*> stack;
-  return AddSubTarget(node, &stack, err);
+  AddResult result = AddSubTarget(node, vector<Node*>(), err);
+  if (result != kAddNew)
+    return result == kAddKnown;
+
+  // Depth-first walk over the inputs with an explicit stack, so that deep
+  // chains can't overflow the native one.  |stack| holds the nodes whose
+  // edges are being expanded and |next_input| the input each is up to.
+  vector<Node*> stack(1, node);
+  vector<size_t> next_input(1, 0);
+  while (!stack.empty()) {
+    Edge* edge = stack.back()->in_edge_;
+    size_t i = next_input.back();
+    if (i == edge->inputs_.size()) {
+      edge->on_plan_stack_ = false;
+      EdgeAdded(edge);
+      stack.pop_back();
+      next_input.pop_back();
+      continue;
+    }
+    ++next_input.back();
+    if (edge->is_implicit(i))
+      continue;
+
+    Node* input = edge->inputs_[i];
+    result = AddSubTarget(input, stack, err);
+    if (result == kAddError) {
+      for (vector<Node*>::iterator n = stack.begin(); n != stack.end(); ++n)
+        (*n)->in_edge_->on_plan_stack_ = false;
+      return false;
+    }
+    if (result == kAddNew) {
+      stack.push_back(input);
+      next_input.push_back(0);
+    }
+  }
+  return true;
 }
 
-bool Plan::AddSubTarget(Node* node, vector<Node*>* stack, string* err) {
+Plan::AddResult Plan::AddSubTarget(Node* node, const vector<Node*>& stack,
+                                   string* err) {
   Edge* edge = node->in_edge_;
   if (!edge) {  // Leaf node.
     if (node->dirty_) {
       string referenced;
-      if (!stack->empty())
-        referenced = ", needed by '" + stack->back()->file_->path_ + "',";
+      if (!stack.empty())
+        referenced = ", needed by '" + stack.back()->file_->path_ + "',";
       *err = "'" + node->file_->path_ + "'" + referenced + " missing "
              "and no known rule to make it";
+      return kAddError;
     }
-    return false;
+    return kAddNothing;
   }
-  assert(edge);
 
   if (CheckDependencyCycle(node, stack, err))
-    return false;
+    return kAddError;
 
   if (!node->dirty())
-    return false;  // Don't need to do anything.
-  if (want_.find(edge) != want_.end())
-    return true;  // We've already enqueued it.
-  want_.insert(edge);
+    return kAddNothing;  // Don't need to do anything.
+  if (edge->plan_state_ != Edge::kNotWanted)
+    return kAddKnown;  // We've already enqueued it.
+
+  edge->plan_state_ = Edge::kWaiting;
+  edge->on_plan_stack_ = true;
+  ++wanted_edges_;
   if (!edge->is_phony())
     ++command_edges_;
 
-  stack->push_back(node);
-  bool awaiting_inputs = false;
+  // Count the inputs that planned edges have yet to produce.  Edges that
+  // join the plan after this point bump the count themselves (below).
+  edge->pending_inputs_ = 0;
   for (vector<Node*>::iterator i = edge->inputs_.begin();
        i != edge->inputs_.end(); ++i) {
-    if (!edge->is_implicit(i - edge->inputs_.begin()) &&
-        AddSubTarget(*i, stack, err)) {
-      awaiting_inputs = true;
-    } else if (!err->empty()) {
-      return false;
+    if ((*i)->in_edge_ && (*i)->in_edge_->plan_state_ != Edge::kNotWanted)
+      ++edge->pending_inputs_;
+  }
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    for (vector<Edge*>::iterator i = (*o)->out_edges_.begin();
+         i != (*o)->out_edges_.end(); ++i) {
+      if ((*i)->plan_state_ == Edge::kWaiting)
+        ++(*i)->pending_inputs_;
     }
   }
-  assert(stack->back() == node);
-  stack->pop_back();
-
-  if (!awaiting_inputs)
-    ready_.insert(edge);
+  return kAddNew;
+}
 
-  return true;
+void Plan::EdgeAdded(Edge* edge) {
+  planned_.push_back(edge);
+  if (edge->pending_inputs_ == 0)
+    EdgeReady(edge);
 }
 
-bool Plan::CheckDependencyCycle(Node* node, vector<Node*>* stack, string* err) {
-  vector<Node*>::reverse_iterator ri =
-      find(stack->rbegin(), stack->rend(), node);
-  if (ri == stack->rend())
+bool Plan::CheckDependencyCycle(Node* node, const vector<Node*>& stack,
+                                string* err) {
+  Edge* edge = node->in_edge_;
+  if (!edge->on_plan_stack_)
     return false;
 
-  // Add this node onto the stack to make it clearer where the loop
-  // is.
-  stack->push_back(node);
+  // The edge is being expanded further up the stack: that's the start of
+  // the loop.  (It may have been reached through a different output.)
+  vector<Node*>::const_iterator start = stack.begin();
+  while ((*start)->in_edge_ != edge)
+    ++start;
 
-  vector<Node*>::iterator start = find(stack->begin(), stack->end(), node);
   *err = "dependency cycle: ";
-  for (vector<Node*>::iterator i = start; i != stack->end(); ++i) {
-    if (i != start)
-      err->append(" -> ");
+  for (vector<Node*>::const_iterator i = start; i != stack.end(); ++i) {
     err->append((*i)->file_->path_);
+    err->append(" -> ");
   }
+  // Add this node at the end to make it clearer where the loop is.
+  err->append(node->file_->path_);
   return true;
 }
 
+namespace {
+
+// Heap order for Plan::ready_: longest critical path first, then the edge
+// that appeared first in the manifest.
+struct EdgePriorityLess {
+  bool operator()(const Edge* a, const Edge* b) const {
+    if (a->critical_time_ms_ != b->critical_time_ms_)
+      return a->critical_time_ms_ < b->critical_time_ms_;
+    return a->id_ > b->id_;
+  }
+};
+
+}  // anonymous namespace
+
+void Plan::ComputeCriticalPath(BuildLog* log) {
+  // Edges without history get the average of those with it, so unknown
+  // steps neither jump the queue nor starve.  With no history at all every
+  // step costs one unit and the weight is the length of the chain.
+  long long known_total = 0;
+  int known_count = 0;
+  for (vector<Edge*>::iterator i = planned_.begin(); i != planned_.end();
+       ++i) {
+    Edge* edge = *i;
+    edge->estimate_ms_ = -1;
+    if (edge->is_phony()) {
+      edge->estimate_ms_ = 0;
+    } else if (log) {
+      BuildLog::LogEntry* entry =
+          log->LookupByOutput(edge->outputs_[0]->file_->path_);
+      if (entry) {
+        edge->estimate_ms_ = entry->time_ms;
+        known_total += entry->time_ms;
+        ++known_count;
+      }
+    }
+  }
+  int default_estimate = known_count ? known_total / known_count : 1;
+  if (default_estimate < 1)
+    default_estimate = 1;
+  has_timings_ = known_count > 0;
+  remaining_time_ms_ = 0;
+
+  // planned_ lists producers before consumers, so walking it backwards
+  // sees every consumer of an edge before the edge itself.
+  for (vector<Edge*>::reverse_iterator i = planned_.rbegin();
+       i != planned_.rend(); ++i) {
+    Edge* edge = *i;
+    int longest_consumer = 0;
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      for (vector<Edge*>::iterator c = (*o)->out_edges_.begin();
+           c != (*o)->out_edges_.end(); ++c) {
+        if ((*c)->plan_state_ != Edge::kNotWanted &&
+            (*c)->critical_time_ms_ > longest_consumer) {
+          longest_consumer = (*c)->critical_time_ms_;
+        }
+      }
+    }
+    if (edge->estimate_ms_ < 0)
+      edge->estimate_ms_ = default_estimate;
+    edge->critical_time_ms_ = edge->estimate_ms_ + longest_consumer;
+    remaining_time_ms_ += edge->estimate_ms_;
+  }
+
+  make_heap(ready_.begin(), ready_.end(), EdgePriorityLess());
+}
+
+int Plan::ready_critical_time_ms() const {
+  return ready_.empty() ? 0 : ready_.front()->critical_time_ms_;
+}
+
+void Plan::EdgeReady(Edge* edge) {
+  edge->plan_state_ = Edge::kReady;
+  ready_.push_back(edge);
+  push_heap(ready_.begin(), ready_.end(), EdgePriorityLess());
+}
+
 Edge* Plan::FindWork() {
-  if (ready_.empty())
-    return NULL;
-  set<Edge*>::iterator i = ready_.begin();
-  Edge* edge = *i;
-  ready_.erase(i);
-  return edge;
+  while (!ready_.empty()) {
+    pop_heap(ready_.begin(), ready_.end(), EdgePriorityLess());
+    Edge* edge = ready_.back();
+    ready_.pop_back();
+
+    if (Pool* pool = edge->pool_) {
+      if (pool->full()) {
+        // Park it until one of the pool's edges finishes, and keep looking
+        // for work elsewhere.
+        pool->delayed_.push_back(edge);
+        push_heap(pool->delayed_.begin(), pool->delayed_.end(),
+                  EdgePriorityLess());
+        continue;
+      }
+      ++pool->current_use_;
+    }
+
+    edge->plan_state_ = Edge::kScheduled;
+    return edge;
+  }
+  return NULL;
 }
 
 void Plan::EdgeFinished(Edge* edge) {
-  want_.erase(edge);
+  EdgeDone(edge);
 
   // Check off any nodes we were waiting for with this edge.
   for (vector<Node*>::iterator i = edge->outputs_.begin();
@@ -205,87 +645,331 @@ void Plan::EdgeFinished(Edge* edge) {
   }
 }
 
+int Plan::EdgeFailed(Edge* edge) {
+  EdgeDone(edge);
+
+  // Everything downstream of the failed outputs is still waiting on them;
+  // drop it from the plan so independent work can run to completion.
+  int dropped = 0;
+  vector<Node*> nodes(edge->outputs_);
+  while (!nodes.empty()) {
+    Node* node = nodes.back();
+    nodes.pop_back();
+    for (vector<Edge*>::iterator i = node->out_edges_.begin();
+         i != node->out_edges_.end(); ++i) {
+      Edge* consumer = *i;
+      if (consumer->plan_state_ != Edge::kWaiting)
+        continue;
+      EdgeDone(consumer);
+      if (!consumer->is_phony())
+        ++dropped;
+      nodes.insert(nodes.end(), consumer->outputs_.begin(),
+                   consumer->outputs_.end());
+    }
+  }
+  return dropped;
+}
+
+void Plan::EdgeDone(Edge* edge) {
+  assert(edge->plan_state_ != Edge::kNotWanted);
+  bool scheduled = edge->plan_state_ == Edge::kScheduled;
+  edge->plan_state_ = Edge::kNotWanted;
+  if (--wanted_edges_ == 0)
+    planned_.clear();
+  remaining_time_ms_ -= edge->estimate_ms_;
+  if (remaining_time_ms_ < 0)
+    remaining_time_ms_ = 0;
+
+  // Give the freed pool slot to the best edge waiting for it.
+  Pool* pool = edge->pool_;
+  if (scheduled && pool) {
+    --pool->current_use_;
+    if (!pool->delayed_.empty()) {
+      pop_heap(pool->delayed_.begin(), pool->delayed_.end(),
+               EdgePriorityLess());
+      Edge* delayed = pool->delayed_.back();
+      pool->delayed_.pop_back();
+      ready_.push_back(delayed);
+      push_heap(ready_.begin(), ready_.end(), EdgePriorityLess());
+    }
+  }
+}
+
 void Plan::NodeFinished(Node* node) {
-  // See if we we want any edges from this node.
+  // Each waiting consumer counted this node as pending; check it off.
   for (vector<Edge*>::iterator i = node->out_edges_.begin();
        i != node->out_edges_.end(); ++i) {
-    if (want_.find(*i) != want_.end()) {
-      // See if the edge is now ready.
-      bool ready = true;
-      for (vector<Node*>::iterator j = (*i)->inputs_.begin();
-           j != (*i)->inputs_.end(); ++j) {
-        if ((*j)->dirty()) {
-          ready = false;
-          break;
-        }
-      }
-      if (ready)
-        ready_.insert(*i);
-    }
+    if ((*i)->plan_state_ != Edge::kWaiting)
+      continue;
+    assert((*i)->pending_inputs_ > 0);
+    if (--(*i)->pending_inputs_ == 0)
+      EdgeReady(*i);
   }
 }
 
 void Plan::Dump() {
-  printf("pending: %d\n", (int)want_.size());
-  for (set<Edge*>::iterator i = want_.begin(); i != want_.end(); ++i) {
-    (*i)->Dump();
-  }
+  printf("pending: %d\n", wanted_edges_);
   printf("ready: %d\n", (int)ready_.size());
 }
 
 struct RealCommandRunner : public CommandRunner {
-  RealCommandRunner(int parallelism) : parallelism_(parallelism) {}
+  RealCommandRunner(const BuildConfig& config)
+      : parallelism_(config.max_jobs > 0 ? config.max_jobs
+                                         : config.parallelism),
+        max_load_average_(config.max_load_average),
+        max_pressure_(config.max_pressure),
+        jobserver_(config.jobserver), waiting_for_token_(false),
+        load_average_(-1), memory_pressure_(-1), cpu_pressure_(-1),
+        held_for_(NULL), load_throttles_(0), pressure_throttles_(0),
+        token_waits_(0), commands_(0), direct_commands_(0) {
+    timerclear(&sampled_);
+  }
   virtual ~RealCommandRunner() {}
   virtual bool CanRunMore();
   virtual bool StartCommand(Edge* edge);
-  virtual bool WaitForCommands();
-  virtual Edge* NextFinishedCommand(bool* success);
+  virtual bool WaitForCommands(int timeout_ms);
+  virtual Edge* NextFinishedCommand(bool* success, ResourceUsage* usage);
+  virtual void PrintSummary();
+  virtual void Abort(int sig);
 
   int parallelism_;
+  double max_load_average_;
+  double max_pressure_;
+  Jobserver* jobserver_;
+  // Whether CanRunMore() last said no for lack of a jobserver token.
+  bool waiting_for_token_;
+  // The load average and pressure as of |sampled_|.  They change slowly,
+  // so CanRunMore() reads them again only once they're a second old.
+  void SampleLoad();
+  double load_average_;
+  double memory_pressure_;
+  double cpu_pressure_;
+  timeval sampled_;
+  // Say no in CanRunMore() because of |reason|, one of the counters
+  // below, which counts each stretch of saying no once.
+  bool HoldBack(int* reason);
+  // What CanRunMore() last held a job back for, or NULL if it didn't.
+  int* held_for_;
+  // Number of times CanRunMore() started holding back jobs, per reason.
+  int load_throttles_;
+  int pressure_throttles_;
+  int token_waits_;
+  // Number of commands started, and how many of them skipped the shell.
+  int commands_;
+  int direct_commands_;
   SubprocessSet subprocs_;
   map<Subprocess*, Edge*> subproc_to_edge_;
+
+  // Kill the commands that have run past their rule's timeout.
+  void KillOverdue();
+  // Milliseconds until the next timeout, or -1 if there is none.
+  int MsUntilTimeout();
+  // When each command with a timeout has to be done by.
+  map<Subprocess*, timeval> deadlines_;
+  // Commands killed for running too long.
+  set<Subprocess*> timed_out_;
 };
 
 bool RealCommandRunner::CanRunMore() {
-  return ((int)subprocs_.running_.size()) < parallelism_;
+  waiting_for_token_ = false;
+  int running = subprocs_.running_.size();
+  if (running >= parallelism_)
+    return false;
+  // Always let one job run so the build keeps making progress.  Jobs that
+  // are already running are never stopped; we only hold back new ones,
+  // and look again when a running job finishes.
+  if (running == 0) {
+    held_for_ = NULL;
+    return true;
+  }
+
+  SampleLoad();
+  if (max_load_average_ > 0 && load_average_ > max_load_average_)
+    return HoldBack(&load_throttles_);
+  if (max_pressure_ > 0 &&
+      (memory_pressure_ > max_pressure_ || cpu_pressure_ > max_pressure_)) {
+    return HoldBack(&pressure_throttles_);
+  }
+  // Check this last, so as not to take a token we then can't use.  The
+  // running jobs hold running - 1 tokens and our implicit slot.
+  if (jobserver_ && jobserver_->tokens_ < running &&
+      !jobserver_->Acquire()) {
+    waiting_for_token_ = true;
+    return HoldBack(&token_waits_);
+  }
+  held_for_ = NULL;
+  return true;
+}
+
+void RealCommandRunner::SampleLoad() {
+  if (max_load_average_ <= 0 && max_pressure_ <= 0)
+    return;
+  timeval now;
+  gettimeofday(&now, NULL);
+  if (timerisset(&sampled_) && ElapsedMs(sampled_, now) < 1000)
+    return;
+  sampled_ = now;
+  if (max_load_average_ > 0)
+    load_average_ = GetLoadAverage();
+  if (max_pressure_ > 0) {
+    memory_pressure_ = GetPressure("memory");
+    cpu_pressure_ = GetPressure("cpu");
+  }
+}
+
+bool RealCommandRunner::HoldBack(int* reason) {
+  if (held_for_ != reason)
+    ++*reason;
+  held_for_ = reason;
+  return false;
+}
+
+void RealCommandRunner::Abort(int sig) {
+  for (map<Subprocess*, Edge*>::iterator i = subproc_to_edge_.begin();
+       i != subproc_to_edge_.end(); ++i) {
+    i->first->Kill(sig);
+  }
+  for (map<Subprocess*, Edge*>::iterator i = subproc_to_edge_.begin();
+       i != subproc_to_edge_.end(); ++i) {
+    i->first->Finish();
+  }
+}
+
+void RealCommandRunner::PrintSummary() {
+  if (load_throttles_) {
+    printf("ninja: held back job starts %d times: load average above %g\n",
+           load_throttles_, max_load_average_);
+  }
+  if (pressure_throttles_) {
+    printf("ninja: held back job starts %d times: CPU or memory pressure "
+           "above %g%%\n", pressure_throttles_, max_pressure_);
+  }
+  if (token_waits_) {
+    printf("ninja: held back job starts %d times: waiting for a jobserver "
+           "token\n", token_waits_);
+  }
+  if (g_show_stats && commands_) {
+    printf("ninja: ran %d of %d commands without a shell\n",
+           direct_commands_, commands_);
+  }
 }
 
 bool RealCommandRunner::StartCommand(Edge* edge) {
   string command = edge->EvaluateCommand();
   Subprocess* subproc = new Subprocess;
   subproc_to_edge_.insert(make_pair(subproc, edge));
-  if (!subproc->Start(command))
+  if (!subproc->Start(command, true))
     return false;
+  ++commands_;
+  if (!subproc->used_shell_)
+    ++direct_commands_;
+  if (int timeout = edge->rule_->timeout_) {
+    timeval deadline;
+    gettimeofday(&deadline, NULL);
+    deadline.tv_sec += timeout;
+    deadlines_[subproc] = deadline;
+  }
 
   subprocs_.Add(subproc);
   return true;
 }
 
-bool RealCommandRunner::WaitForCommands() {
+bool RealCommandRunner::WaitForCommands(int timeout_ms) {
   if (subprocs_.running_.empty())
     return false;
 
+  timeval start;
+  gettimeofday(&start, NULL);
   while (subprocs_.finished_.empty()) {
-    subprocs_.DoWork();
+    // Don't sit on tokens for commands that finished or never started.
+    if (jobserver_)
+      jobserver_->ReleaseUnused(subprocs_.running_.size());
+    // If we're short of a token, look again once one may be available.
+    int wake_fd = waiting_for_token_ ? jobserver_->read_fd_ : -1;
+    // Output from commands doesn't restart the timeout.
+    int wait_ms = timeout_ms;
+    if (timeout_ms > 0) {
+      timeval now;
+      gettimeofday(&now, NULL);
+      wait_ms = max(timeout_ms - ElapsedMs(start, now), 0);
+    }
+    int kill_ms = MsUntilTimeout();
+    if (kill_ms >= 0 && (wait_ms < 0 || kill_ms < wait_ms))
+      wait_ms = kill_ms;
+    bool woken = subprocs_.DoWork(wake_fd, wait_ms);
+    KillOverdue();
+    if (woken)
+      break;
   }
   return true;
 }
 
-Edge* RealCommandRunner::NextFinishedCommand(bool* success) {
+void RealCommandRunner::KillOverdue() {
+  if (deadlines_.empty())
+    return;
+  timeval now;
+  gettimeofday(&now, NULL);
+  for (map<Subprocess*, timeval>::iterator i = deadlines_.begin();
+       i != deadlines_.end(); ) {
+    if (timercmp(&i->second, &now, >)) {
+      ++i;
+      continue;
+    }
+    i->first->Kill();
+    timed_out_.insert(i->first);
+    deadlines_.erase(i++);
+  }
+}
+
+int RealCommandRunner::MsUntilTimeout() {
+  if (deadlines_.empty())
+    return -1;
+  timeval now;
+  gettimeofday(&now, NULL);
+  int ms = -1;
+  for (map<Subprocess*, timeval>::iterator i = deadlines_.begin();
+       i != deadlines_.end(); ++i) {
+    int left = max(ElapsedMs(now, i->second), 0);
+    if (ms < 0 || left < ms)
+      ms = left;
+  }
+  return ms;
+}
+
+Edge* RealCommandRunner::NextFinishedCommand(bool* success,
+                                             ResourceUsage* usage) {
   Subprocess* subproc = subprocs_.NextFinished();
   if (!subproc)
     return NULL;
 
   *success = subproc->Finish();
 
+  const struct rusage& ru = subproc->rusage_;
+  usage->user_ms = ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000;
+  usage->system_ms = ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000;
+  usage->max_rss_kb = ru.ru_maxrss;
+  usage->in_blocks = ru.ru_inblock;
+  usage->out_blocks = ru.ru_oublock;
+
   map<Subprocess*, Edge*>::iterator i = subproc_to_edge_.find(subproc);
   Edge* edge = i->second;
   subproc_to_edge_.erase(i);
+  deadlines_.erase(subproc);
+  string failed = "FAILED: ";
+  if (timed_out_.erase(subproc)) {
+    *success = false;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "FAILED (killed after %ds): ",
+             edge->rule_->timeout_);
+    failed = buf;
+  }
+  if (jobserver_)
+    jobserver_->ReleaseUnused(subprocs_.running_.size());
 
   if (!*success ||
       !subproc->stdout_.buf_.empty() ||
       !subproc->stderr_.buf_.empty()) {
-    printf("\n%s%s\n", *success ? "" : "FAILED: ",
+    printf("\n%s%s\n", *success ? "" : failed.c_str(),
            edge->EvaluateCommand().c_str());
     if (!subproc->stdout_.buf_.empty())
       printf("%s\n", subproc->stdout_.buf_.c_str());
@@ -306,10 +990,10 @@ struct DryRunCommandRunner : public CommandRunner {
     finished_.push(edge);
     return true;
   }
-  virtual bool WaitForCommands() {
+  virtual bool WaitForCommands(int timeout_ms) {
     return true;
   }
-  virtual Edge* NextFinishedCommand(bool* success) {
+  virtual Edge* NextFinishedCommand(bool* success, ResourceUsage* usage) {
     if (finished_.empty())
       return NULL;
     *success = true;
@@ -322,74 +1006,194 @@ struct DryRunCommandRunner : public CommandRunner {
 };
 
 Builder::Builder(State* state, const BuildConfig& config)
-    : state_(state) {
+    : state_(state), failures_allowed_(config.failures_allowed),
+      skipped_edges_(0) {
   disk_interface_ = new RealDiskInterface;
   if (config.dry_run)
     command_runner_ = new DryRunCommandRunner;
   else
-    command_runner_ = new RealCommandRunner(config.parallelism);
+    command_runner_ = new RealCommandRunner(config);
   status_ = new BuildStatus;
   status_->verbosity_ = config.verbosity;
+  status_->plan_ = &plan_;
+  status_->parallelism_ = config.parallelism;
+  if (config.status_rate > 0)
+    status_->redraw_interval_ms_ = 1000 / config.status_rate;
+  status_->stall_report_ms_ = config.stall_report_ms;
   log_ = state->build_log_;
+  status_->log_ = log_;
+  trace_ = NULL;
+  action_cache_ = NULL;
+}
+
+void Builder::SetTrace(Trace* trace) {
+  trace_ = trace;
+  status_->trace_ = trace;
+}
+
+bool Builder::UseWorkers(const vector<string>& addresses, string* err) {
+  RemoteCommandRunner* runner = new RemoteCommandRunner;
+  for (vector<string>::const_iterator i = addresses.begin();
+       i != addresses.end(); ++i) {
+    if (!runner->AddWorker(*i, err)) {
+      delete runner;
+      return false;
+    }
+  }
+  delete command_runner_;
+  command_runner_ = runner;
+  status_->parallelism_ = runner->capacity();
+  return true;
 }
 
 Node* Builder::AddTarget(const string& name, string* err) {
   Node* node = state_->LookupNode(name);
+  if (!node && !name.empty() && name[name.size() - 1] == '^')
+    return AddTargetsUsing(name.substr(0, name.size() - 1), err);
   if (!node) {
     *err = "unknown target: '" + name + "'";
     return NULL;
   }
-  node->file_->StatIfNecessary(disk_interface_);
-  if (node->in_edge_) {
-    if (!node->in_edge_->RecomputeDirty(state_, disk_interface_, err))
-      return NULL;
+  return AddTarget(node, err);
+}
+
+Node* Builder::AddTarget(Node* node, string* err) {
+  {
+    ScopedTracePhase phase(trace_, "dirty scan");
+    node->file_->StatIfNecessary(disk_interface_);
+    if (node->in_edge_) {
+      if (!node->in_edge_->RecomputeDirty(state_, disk_interface_, err))
+        return NULL;
+    }
   }
   if (!node->dirty_)
     return NULL;  // Intentionally no error.
 
+  ScopedTracePhase phase(trace_, "plan construction");
   if (!plan_.AddTarget(node, err))
     return NULL;
   return node;
 }
 
+Node* Builder::AddTargetsUsing(const string& path, string* err) {
+  Node* source = state_->LookupNode(path);
+  if (!source) {
+    *err = "unknown target: '" + path + "^'";
+    return NULL;
+  }
+  if (source->out_edges_.empty()) {
+    *err = "'" + path + "' is not an input of any build statement";
+    return NULL;
+  }
+
+  // Only the subgraphs under these outputs are stat()ed and planned; the
+  // rest of the graph is never looked at.
+  Node* first = NULL;
+  for (vector<Edge*>::iterator i = source->out_edges_.begin();
+       i != source->out_edges_.end(); ++i) {
+    Node* node = AddTarget((*i)->outputs_[0], err);
+    if (!err->empty())
+      return NULL;
+    if (!first)
+      first = node;
+  }
+  return first;
+}
+
 bool Builder::Build(string* err) {
   if (!plan_.more_to_do()) {
     *err = "no work to do";
     return true;
   }
 
+  {
+    ScopedTracePhase phase(trace_, "critical path");
+    plan_.ComputeCriticalPath(log_);
+  }
   status_->PlanHasTotalEdges(plan_.command_edge_count());
+  ScopedDumpSignal dump_signal;
+  ScopedInterruptSignals interrupt_signals;
+  int pending_commands = 0;
+  int failures_allowed = failures_allowed_;
   while (plan_.more_to_do()) {
-    while (command_runner_->CanRunMore()) {
+    if (g_interrupted) {
+      command_runner_->Abort(g_interrupted);
+      *err = "interrupted by user";
+      return false;
+    }
+    if (g_dump_requested) {
+      g_dump_requested = 0;
+      DumpState(pending_commands);
+    }
+
+    // Once too many commands have failed, start nothing new but let the
+    // running ones finish so their failures get reported too.
+    while (failures_allowed > 0 && command_runner_->CanRunMore()) {
       Edge* edge = plan_.FindWork();
       if (!edge)
         break;
 
+      int cached_ms = -1;
+      if (edge->is_phony() || RestoreFromCache(edge, &cached_ms)) {
+        FinishEdge(edge, NULL, cached_ms);
+        continue;
+      }
       if (!StartEdge(edge, err))
         return false;
-
-      if (edge->is_phony())
-        FinishEdge(edge);
+      ++pending_commands;
     }
 
-    if (!plan_.more_to_do())
+    if (!plan_.more_to_do() || pending_commands == 0)
       break;
 
     bool success;
-    if (Edge* edge = command_runner_->NextFinishedCommand(&success)) {
+    ResourceUsage usage;
+    if (Edge* edge = command_runner_->NextFinishedCommand(&success, &usage)) {
+      --pending_commands;
       if (!success) {
-        *err = "subcommand failed";
-        return false;
+        status_->BuildEdgeFinished(edge);
+        failed_edges_.push_back(edge);
+        skipped_edges_ += plan_.EdgeFailed(edge);
+        if (failures_allowed > 0)
+          --failures_allowed;
+        continue;
       }
-      FinishEdge(edge);
+      int ms = FinishEdge(edge, &usage);
+      if (action_cache_)
+        action_cache_->Store(edge, ms);
     } else {
-      if (!command_runner_->WaitForCommands()) {
+      // Draw a status line the redraw limit held back, and say what we're
+      // waiting for if it's taking long; otherwise wake up when either
+      // is due.
+      status_->RedrawStatus(false);
+      status_->ReportStall();
+      int timeout_ms = status_->MsUntilRedraw();
+      int stall_ms = status_->MsUntilStallReport();
+      if (stall_ms >= 0 && (timeout_ms < 0 || stall_ms < timeout_ms))
+        timeout_ms = stall_ms;
+      if (!command_runner_->WaitForCommands(timeout_ms)) {
         *err = "stuck [this is a bug]";
         return false;
       }
     }
   }
 
+  if (!failed_edges_.empty()) {
+    if (failed_edges_.size() == 1) {
+      *err = "subcommand failed";
+    } else {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%d subcommands failed",
+               (int)failed_edges_.size());
+      *err = buf;
+    }
+    return false;
+  }
+  if (plan_.more_to_do()) {
+    *err = "stuck [this is a bug]";
+    return false;
+  }
+
   return true;
 }
 
@@ -399,13 +1203,10 @@ bool Builder::StartEdge(Edge* edge, string* err) {
 
   status_->BuildEdgeStarted(edge);
 
-  // Create directories necessary for outputs.
-  // XXX: this will block; do we care?
-  for (vector<Node*>::iterator i = edge->outputs_.begin();
-       i != edge->outputs_.end(); ++i) {
-    if (!disk_interface_->MakeDirs((*i)->file_->path_))
-      return false;
-  }
+  // Create directories necessary for outputs.  Only edges that actually
+  // run get them; the stat cache makes repeats a lookup.
+  if (!MakeOutputDirs(edge, err))
+    return false;
 
   // Compute command and start it.
   string command = edge->EvaluateCommand();
@@ -417,19 +1218,82 @@ bool Builder::StartEdge(Edge* edge, string* err) {
   return true;
 }
 
-void Builder::FinishEdge(Edge* edge) {
+bool Builder::RestoreFromCache(Edge* edge, int* time_ms) {
+  if (!action_cache_)
+    return false;
+  // If the directories can't be made, StartEdge() will report it.
+  string err;
+  if (!MakeOutputDirs(edge, &err) || !action_cache_->Restore(edge, time_ms))
+    return false;
+  status_->BuildEdgeStarted(edge);
+  return true;
+}
+
+bool Builder::MakeOutputDirs(Edge* edge, string* err) {
+  for (vector<Node*>::iterator i = edge->outputs_.begin();
+       i != edge->outputs_.end(); ++i) {
+    if (!state_->stat_cache()->MakeDirs(disk_interface_,
+                                        (*i)->file_->path_)) {
+      *err = "couldn't create directory for '" + (*i)->file_->path_ + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+void Builder::DumpState(int running) {
+  status_->EndStatusLine();
+  printf("ninja: %d of %d job slots busy, %d commands ready to start, "
+         "%d edges left to finish\n", running, status_->parallelism_,
+         plan_.ready_count(), plan_.wanted_count());
+  status_->PrintRunning(status_->running_edges_.size());
+  fflush(stdout);
+}
+
+void Builder::PrintSummary() {
+  if (status_->verbosity_ == BuildConfig::QUIET)
+    return;
+  command_runner_->PrintSummary();
+
+  // Each failure was printed in full as it happened; list them again so
+  // they're easy to find at the end of a long log.
+  if (failed_edges_.size() > 1) {
+    printf("ninja: %d commands failed:\n", (int)failed_edges_.size());
+    for (vector<Edge*>::iterator i = failed_edges_.begin();
+         i != failed_edges_.end(); ++i) {
+      printf("  %s\n", (*i)->outputs_[0]->file_->path_.c_str());
+    }
+  }
+  if (skipped_edges_) {
+    printf("ninja: skipped %d commands that depend on failed outputs\n",
+           skipped_edges_);
+  }
+  if (action_cache_ && action_cache_->hits_ + action_cache_->misses_ > 0) {
+    printf("ninja: action cache: %d hits, %d misses\n",
+           action_cache_->hits_, action_cache_->misses_);
+  }
+}
+
+int Builder::FinishEdge(Edge* edge, const ResourceUsage* usage,
+                        int cached_ms) {
   for (vector<Node*>::iterator i = edge->outputs_.begin();
        i != edge->outputs_.end(); ++i) {
     // XXX check that the output actually changed
     // XXX just notify node and have it propagate?
     (*i)->dirty_ = false;
+    // The command has changed it on disk, so what the stat cache knows
+    // is stale; e.g. a directory output may now exist.
+    (*i)->file_->mtime_ = -1;
   }
   plan_.EdgeFinished(edge);
 
   if (edge->is_phony())
-    return;
+    return 0;
 
   int ms = status_->BuildEdgeFinished(edge);
+  // A cache restore takes next to no time; log how long the command took
+  // when it ran, so the critical path and ETA still see its cost.
   if (log_)
-    log_->RecordCommand(edge, ms);
+    log_->RecordCommand(edge, cached_ms >= 0 ? cached_ms : ms, usage);
+  return ms;
 }
@@ -21,10 +21,15 @@
 #include <vector>
 using namespace std;
 
+struct ActionCache;
+struct BuildLog;
 struct Edge;
 struct DiskInterface;
+struct Jobserver;
 struct Node;
+struct ResourceUsage;
 struct State;
+struct Trace;
 
 // Plan stores the state of a build plan: what we intend to build,
 // which steps we're ready to execute.
@@ -36,12 +41,18 @@ struct Plan {
   // fill in |err| with an error message if there's a problem.
   bool AddTarget(Node* node, string* err);
 
+  // Weight every planned edge by the longest chain of estimated durations
+  // from it to the end of the build, using the times recorded in |log|
+  // (which may be NULL).  Call once all targets have been added; FindWork
+  // then prefers edges on the critical path.
+  void ComputeCriticalPath(BuildLog* log);
+
   // Pop a ready edge off the queue of edges to build.
   // Returns NULL if there's no work to do.
   Edge* FindWork();
 
   // Returns true if there's more work to be done.
-  bool more_to_do() const { return !want_.empty(); }
+  bool more_to_do() const { return wanted_edges_ > 0; }
 
   // Dumps the current state of the plan.
   void Dump();
@@ -50,19 +61,58 @@ struct Plan {
   // tests.
   void EdgeFinished(Edge* edge);
 
+  // Mark an edge as failed: it leaves the plan along with every edge
+  // that (transitively) waits on its outputs, since those can never run.
+  // Returns the number of dependent edges with commands that were dropped.
+  int EdgeFailed(Edge* edge);
+
   // Number of edges with commands to run.
   int command_edge_count() const { return command_edges_; }
+  // Number of edges ready to start, and of edges not yet finished.
+  int ready_count() const { return ready_.size(); }
+  int wanted_count() const { return wanted_edges_; }
+
+  // Whether ComputeCriticalPath() found any logged timings; without them
+  // the time estimates below are meaningless.
+  bool has_timings() const { return has_timings_; }
+  // Sum of the estimated run times of the edges not yet finished.
+  long long remaining_time_ms() const { return remaining_time_ms_; }
+  // Longest critical path among the edges that are ready to run.
+  int ready_critical_time_ms() const;
 
 private:
-  bool AddSubTarget(Node* node, vector<Node*>* stack, string* err);
-  bool CheckDependencyCycle(Node* node, vector<Node*>* stack, string* err);
+  // What AddSubTarget() did with a node.
+  enum AddResult {
+    kAddError,    // Filled in |err|.
+    kAddNothing,  // The node needs no building.
+    kAddKnown,    // Its edge was already in the plan.
+    kAddNew       // Its edge joined the plan; its inputs need adding.
+  };
+  AddResult AddSubTarget(Node* node, const vector<Node*>& stack,
+                         string* err);
+  bool CheckDependencyCycle(Node* node, const vector<Node*>& stack,
+                            string* err);
+  // Finish adding an edge whose inputs have all been added.
+  void EdgeAdded(Edge* edge);
   void NodeFinished(Node* node);
-
-  set<Edge*> want_;
-  set<Edge*> ready_;
+  void EdgeReady(Edge* edge);
+  // Release |edge|'s plan bookkeeping and any pool slot it held.
+  void EdgeDone(Edge* edge);
+
+  // Plan membership lives in Edge::plan_state_; this counts the edges
+  // that are in the plan and not yet finished.
+  int wanted_edges_;
+  // Every edge added to the plan, producers before consumers.
+  vector<Edge*> planned_;
+  // Edges whose inputs are all done, as a heap ordered by
+  // Edge::critical_time_ms_.
+  vector<Edge*> ready_;
 
   // Total number of edges that have commands (not phony).
   int command_edges_;
+
+  bool has_timings_;
+  long long remaining_time_ms_;
 };
 
 // CommandRunner is an interface that wraps running the build
@@ -72,14 +122,23 @@ struct CommandRunner {
   virtual ~CommandRunner() {}
   virtual bool CanRunMore() = 0;
   virtual bool StartCommand(Edge* edge) = 0;
-  // Wait for commands to make progress; return false if there is no
-  // progress to be made.
-  virtual bool WaitForCommands() = 0;
-  virtual Edge* NextFinishedCommand(bool* success) = 0;
+  // Wait for commands to make progress, or for |timeout_ms| if that is
+  // not negative; return false if there is no progress to be made.
+  virtual bool WaitForCommands(int timeout_ms) = 0;
+  // Return a finished command, if any.  Runners that can measure it
+  // fill in |usage| with the resources the command used.
+  virtual Edge* NextFinishedCommand(bool* success, ResourceUsage* usage) = 0;
+  // Print anything noteworthy about how the commands were run.
+  virtual void PrintSummary() {}
+  // Pass |sig| on to the running commands and wait for them to exit.
+  virtual void Abort(int sig) {}
 };
 
 struct BuildConfig {
-  BuildConfig() : verbosity(NORMAL), dry_run(false), parallelism(1) {}
+  BuildConfig() : verbosity(NORMAL), dry_run(false), parallelism(1),
+                  failures_allowed(1), max_load_average(0),
+                  max_pressure(0), jobserver(NULL), max_jobs(0),
+                  status_rate(20), stall_report_ms(30000) {}
 
   enum Verbosity {
     NORMAL,
@@ -89,16 +148,63 @@ struct BuildConfig {
   Verbosity verbosity;
   bool dry_run;
   int parallelism;
+  // Stop starting new commands once this many have failed.
+  int failures_allowed;
+  // Don't start new jobs while the load average exceeds this (if > 0).
+  double max_load_average;
+  // Don't start new jobs while CPU or memory pressure, as a percentage
+  // of stalled time, exceeds this (if > 0).
+  double max_pressure;
+  // If set, take a token from this make jobserver for every command
+  // beyond the first.
+  Jobserver* jobserver;
+  // If > 0, run up to this many commands at once instead of
+  // |parallelism|, which then only guides the ETA.  Used when make's
+  // jobserver decides how many commands run.
+  int max_jobs;
+  // Redraw the status line at most this many times a second; 0 redraws
+  // it on every change.
+  int status_rate;
+  // When no command has finished for this long, list the ones that have
+  // been running longest (if > 0).
+  int stall_report_ms;
 };
 
 struct Builder {
   Builder(State* state, const BuildConfig& config);
 
+  // Add the target |name| to the plan.  "path^" means the first output
+  // of every build statement that has |path| as an input, e.g. the object
+  // files built from a source file.  Returns NULL, with |err| empty, if
+  // there is nothing to do.
   Node* AddTarget(const string& name, string* err);
+  Node* AddTarget(Node* node, string* err);
+  Node* AddTargetsUsing(const string& path, string* err);
   bool Build(string* err);
 
   bool StartEdge(Edge* edge, string* err);
-  void FinishEdge(Edge* edge);
+  // Put |edge|'s outputs in place from the action cache, if it has them,
+  // and set |time_ms| to how long the cached run took (-1 if unknown).
+  bool RestoreFromCache(Edge* edge, int* time_ms);
+  // Mark |edge| done and log it, as taking |cached_ms| if that is >= 0.
+  // Returns how long it ran.
+  int FinishEdge(Edge* edge, const ResourceUsage* usage = NULL,
+                 int cached_ms = -1);
+  bool MakeOutputDirs(Edge* edge, string* err);
+
+  // Record the build's phases and commands in |trace| (may be NULL).
+  void SetTrace(Trace* trace);
+
+  // Send commands to the ninja_worker daemons at |addresses| ("host:port")
+  // instead of running them here.
+  bool UseWorkers(const vector<string>& addresses, string* err);
+
+  // Print end-of-build notes, such as which commands failed and how
+  // often job starts were held back.
+  void PrintSummary();
+  // Print the running commands and how busy the job slots and queue are;
+  // Build() does this on SIGUSR1.
+  void DumpState(int running);
 
   State* state_;
   Plan plan_;
@@ -106,6 +212,15 @@ struct Builder {
   CommandRunner* command_runner_;
   struct BuildStatus* status_;
   struct BuildLog* log_;
+  Trace* trace_;
+  // If set, commands whose results are cached aren't run.
+  ActionCache* action_cache_;
+
+  int failures_allowed_;
+  // Commands that failed during Build(), in the order they finished.
+  vector<Edge*> failed_edges_;
+  // Edges dropped from the plan because something they need failed.
+  int skipped_edges_;
 };
 
 #endif  // NINJA_BUILD_H_
@@ -16,7 +16,13 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
 
 #include "build.h"
 #include "graph.h"
@@ -28,17 +34,132 @@
 // older runs.
 // Once the number of redundant entries exceeds a threshold, we write
 // out a new file and replace the existing one with it.
+//
+// Version 1 logs have lines of the form
+//   time_ms output command
+// Version 2 logs start with a "# ninja log v2" line and add the
+// command's resource usage before the output:
+//   time_ms user_ms system_ms max_rss_kb in_blocks out_blocks output command
+// A version 1 log is rewritten as version 2 before we append to it.
+//
+// Version 3 logs are binary, with integers in the host's byte order:
+//   a BinaryHeader;
+//   record_count BinaryRecords, which refer to their output and command
+//     by offset and length within the strings;
+//   index_size slots, a power of two at least twice record_count, each
+//     holding a record number plus one or 0 if empty.  A record goes in
+//     the first empty slot at or after its output's hash, wrapping round;
+//   strings_size bytes of outputs and commands, padded to 8 bytes;
+//   the commands run since, each a BinaryRecord directly followed by its
+//     output and command and padded to 8 bytes.
+// Once more commands have been appended than the snapshot holds, the
+// whole log is rewritten.  Text and binary logs are never mixed.
+
+struct BuildLog::BinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_count;
+  uint32_t index_size;
+  uint32_t strings_size;
+};
+
+struct BuildLog::BinaryRecord {
+  uint32_t output;
+  uint32_t output_len;
+  uint32_t command;
+  uint32_t command_len;
+  // Hash of the output, to skip most comparisons while probing.
+  uint32_t hash;
+  int32_t time_ms;
+  int32_t user_ms;
+  int32_t system_ms;
+  int64_t max_rss_kb;
+  int64_t in_blocks;
+  int64_t out_blocks;
+};
+
+namespace {
+
+const char kFileSignature[] = "# ninja log v%d\n";
+const int kCurrentVersion = 2;
+const char kBinaryMagic[8] = { 'N', 'I', 'N', 'J', 'A', 'L', 'O', 'G' };
+const uint32_t kBinaryVersion = 3;
+
+// FNV-1a.  It's stored in the log, so it mustn't change.
+uint32_t HashPath(const char* path, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+size_t Align8(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+// Pad a |size|-byte section to 8 bytes.
+void Pad8(FILE* f, size_t size) {
+  static const char kZeros[8] = { 0 };
+  fwrite(kZeros, 1, Align8(size) - size, f);
+}
+
+// A record for |entry|, with its strings still to be placed.
+BuildLog::BinaryRecord MakeRecord(const BuildLog::LogEntry& entry) {
+  BuildLog::BinaryRecord record;
+  memset(&record, 0, sizeof(record));
+  record.output_len = entry.output.size();
+  record.command_len = entry.command.size();
+  record.hash = HashPath(entry.output.data(), entry.output.size());
+  record.time_ms = entry.time_ms;
+  record.user_ms = entry.usage.user_ms;
+  record.system_ms = entry.usage.system_ms;
+  record.max_rss_kb = entry.usage.max_rss_kb;
+  record.in_blocks = entry.usage.in_blocks;
+  record.out_blocks = entry.usage.out_blocks;
+  return record;
+}
+
+// Copy everything but the strings from |record| to |entry|.
+void ReadRecord(const BuildLog::BinaryRecord& record,
+                BuildLog::LogEntry* entry) {
+  entry->time_ms = record.time_ms;
+  entry->usage.user_ms = record.user_ms;
+  entry->usage.system_ms = record.system_ms;
+  entry->usage.max_rss_kb = record.max_rss_kb;
+  entry->usage.in_blocks = record.in_blocks;
+  entry->usage.out_blocks = record.out_blocks;
+}
+
+}  // anonymous namespace
 
 BuildLog::BuildLog()
-  : log_file_(NULL), config_(NULL), needs_recompaction_(false) {}
+  : log_file_(NULL), config_(NULL), needs_recompaction_(false),
+    log_version_(0), binary_(false), map_(NULL), map_size_(0),
+    records_(NULL), record_count_(0), index_(NULL), index_size_(0),
+    strings_(NULL), strings_size_(0), binary_end_(0) {}
+
+BuildLog::~BuildLog() {
+  if (map_)
+    munmap(map_, map_size_);
+}
 
 bool BuildLog::OpenForWrite(const string& path, string* err) {
   if (config_ && config_->dry_run)
     return true;  // Do nothing, report success.
 
-  if (needs_recompaction_) {
+  if (needs_recompaction_ ||
+      (!binary_ && log_version_ != 0 && log_version_ < kCurrentVersion)) {
     if (!Recompact(path, err))
       return false;
+  } else if (binary_ && binary_end_ < map_size_) {
+    // Drop what's left of an entry a crash cut short, so that new
+    // entries line up.
+    if (truncate(path.c_str(), binary_end_) < 0) {
+      *err = strerror(errno);
+      return false;
+    }
   }
 
   log_file_ = fopen(path.c_str(), "ab");
@@ -46,11 +167,24 @@ bool BuildLog::OpenForWrite(const string& path, string* err) {
     *err = strerror(errno);
     return false;
   }
-  setlinebuf(log_file_);
+  if (!binary_)
+    setlinebuf(log_file_);
+
+  // A new (or empty) file needs the version line, or the binary header.
+  if (ftell(log_file_) == 0) {
+    if (binary_) {
+      if (!WriteBinarySnapshot(log_file_, err))
+        return false;
+      fflush(log_file_);
+    } else {
+      fprintf(log_file_, kFileSignature, kCurrentVersion);
+    }
+  }
   return true;
 }
 
-void BuildLog::RecordCommand(Edge* edge, int time_ms) {
+void BuildLog::RecordCommand(Edge* edge, int time_ms,
+                             const ResourceUsage* usage) {
   if (!log_file_)
     return;
 
@@ -69,8 +203,12 @@ void BuildLog::RecordCommand(Edge* edge, int time_ms) {
     log_entry->output = path;
     log_entry->command = command;
     log_entry->time_ms = time_ms;
+    log_entry->usage = usage ? *usage : ResourceUsage();
 
-    WriteEntry(log_file_, *log_entry);
+    if (binary_)
+      WriteBinaryEntry(log_file_, *log_entry);
+    else
+      WriteEntry(log_file_, *log_entry);
   }
 }
 
@@ -88,11 +226,37 @@ bool BuildLog::Load(const string& path, string* err) {
     return false;
   }
 
+  char magic[sizeof(kBinaryMagic)];
+  if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+      memcmp(magic, kBinaryMagic, sizeof(magic)) == 0) {
+    bool loaded = LoadBinary(fileno(file), err);
+    fclose(file);
+    return loaded;
+  }
+  rewind(file);
+
   int unique_entry_count = 0;
   int total_entry_count = 0;
 
-  char buf[256 << 10];
-  while (fgets(buf, sizeof(buf), file)) {
+  // Lines are as long as the commands in them, so let getline() size
+  // the buffer.
+  char* buf = NULL;
+  size_t buf_size = 0;
+  ssize_t len;
+  log_version_ = 1;
+  bool first_line = true;
+  while ((len = getline(&buf, &buf_size, file)) >= 0) {
+    if (len > 0 && buf[len - 1] == '\n')
+      buf[--len] = 0;
+    if (first_line) {
+      first_line = false;
+      int version;
+      if (sscanf(buf, kFileSignature, &version) == 1) {
+        log_version_ = version;
+        continue;
+      }
+    }
+
     char* start = buf;
     char* end = strchr(start, ' ');
     if (!end)
@@ -101,7 +265,26 @@ bool BuildLog::Load(const string& path, string* err) {
     *end = 0;
     int time_ms = atoi(start);
     start = end + 1;
+
+    ResourceUsage usage;
+    if (log_version_ >= 2) {
+      if (sscanf(start, "%d %d %ld %ld %ld", &usage.user_ms,
+                 &usage.system_ms, &usage.max_rss_kb, &usage.in_blocks,
+                 &usage.out_blocks) != 5) {
+        continue;
+      }
+      for (int field = 0; field < 5 && start; ++field) {
+        start = strchr(start, ' ');
+        if (start)
+          ++start;
+      }
+      if (!start)
+        continue;
+    }
+
     end = strchr(start, ' ');
+    if (!end)
+      continue;
     string output = string(start, end - start);
 
     LogEntry* entry;
@@ -116,12 +299,14 @@ bool BuildLog::Load(const string& path, string* err) {
     ++total_entry_count;
 
     entry->time_ms = time_ms;
+    entry->usage = usage;
     entry->output = output;
 
     start = end + 1;
-    end = strchr(start, '\n');
-    entry->command = string(start, end - start);
+    entry->command = string(start, buf + len - start);
   }
+  free(buf);
+  fclose(file);
 
   // Mark the log as "needs rebuiding" if it has kCompactionRatio times
   // too many log entries.
@@ -132,16 +317,196 @@ bool BuildLog::Load(const string& path, string* err) {
   return true;
 }
 
+bool BuildLog::LoadBinary(int fd, string* err) {
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    *err = strerror(errno);
+    return false;
+  }
+  map_ = (char*)map;
+  map_size_ = st.st_size;
+
+  // The sections must fit in the file; records are checked as they're
+  // decoded.
+  const BinaryHeader* header = (const BinaryHeader*)map_;
+  if (map_size_ < sizeof(BinaryHeader)) {
+    *err = "binary log truncated";
+    return false;
+  }
+  if (header->version != kBinaryVersion) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "unknown binary log version %u",
+             header->version);
+    *err = buf;
+    return false;
+  }
+  uint64_t index_at = sizeof(BinaryHeader) +
+      (uint64_t)header->record_count * sizeof(BinaryRecord);
+  uint64_t strings_at = index_at +
+      (uint64_t)header->index_size * sizeof(uint32_t);
+  uint64_t end = Align8(strings_at + header->strings_size);
+  if (end > map_size_ || header->index_size == 0 ||
+      (header->index_size & (header->index_size - 1)) != 0) {
+    *err = "binary log corrupt";
+    return false;
+  }
+  records_ = (const BinaryRecord*)(map_ + sizeof(BinaryHeader));
+  record_count_ = header->record_count;
+  index_ = (const uint32_t*)(map_ + index_at);
+  index_size_ = header->index_size;
+  strings_ = map_ + strings_at;
+  strings_size_ = header->strings_size;
+  log_version_ = kBinaryVersion;
+  binary_ = true;
+
+  // Take in the commands appended since, up to any cut short by a crash.
+  uint32_t appended = 0;
+  size_t pos = end;
+  while (map_size_ - pos >= sizeof(BinaryRecord)) {
+    const BinaryRecord* record = (const BinaryRecord*)(map_ + pos);
+    size_t size = Align8(sizeof(BinaryRecord) + (size_t)record->output_len +
+                         record->command_len);
+    if (size > map_size_ - pos)
+      break;
+    const char* output = (const char*)(record + 1);
+    string path(output, record->output_len);
+    LogEntry*& entry = log_[path];
+    if (!entry)
+      entry = new LogEntry;
+    entry->output = path;
+    entry->command.assign(output + record->output_len, record->command_len);
+    ReadRecord(*record, entry);
+    pos += size;
+    ++appended;
+  }
+  binary_end_ = pos;
+
+  if (appended > record_count_)
+    needs_recompaction_ = true;
+
+  return true;
+}
+
+BuildLog::LogEntry* BuildLog::DecodeRecord(uint32_t index) {
+  const BinaryRecord& record = records_[index];
+  if ((uint64_t)record.output + record.output_len > strings_size_ ||
+      (uint64_t)record.command + record.command_len > strings_size_) {
+    return NULL;
+  }
+  LogEntry* entry = new LogEntry;
+  entry->output.assign(strings_ + record.output, record.output_len);
+  pair<Log::iterator, bool> inserted =
+      log_.insert(make_pair(entry->output, entry));
+  if (!inserted.second) {
+    // Appended or recorded since, or already decoded.
+    delete entry;
+    return inserted.first->second;
+  }
+  entry->command.assign(strings_ + record.command, record.command_len);
+  ReadRecord(record, entry);
+  return entry;
+}
+
 BuildLog::LogEntry* BuildLog::LookupByOutput(const string& path) {
   Log::iterator i = log_.find(path);
   if (i != log_.end())
     return i->second;
+  if (!index_size_)
+    return NULL;
+
+  uint32_t hash = HashPath(path.data(), path.size());
+  uint32_t mask = index_size_ - 1;
+  for (uint32_t probe = 0; probe < index_size_; ++probe) {
+    uint32_t slot = index_[(hash + probe) & mask];
+    if (slot == 0 || slot > record_count_)
+      return NULL;
+    const BinaryRecord& record = records_[slot - 1];
+    if (record.hash == hash && record.output_len == path.size() &&
+        (uint64_t)record.output + record.output_len <= strings_size_ &&
+        memcmp(strings_ + record.output, path.data(), path.size()) == 0) {
+      return DecodeRecord(slot - 1);
+    }
+  }
   return NULL;
 }
 
+void BuildLog::DecodeAll() {
+  for (uint32_t i = 0; i < record_count_; ++i)
+    DecodeRecord(i);
+}
+
 void BuildLog::WriteEntry(FILE* f, const LogEntry& entry) {
-  fprintf(f, "%d %s %s\n",
-          entry.time_ms, entry.output.c_str(), entry.command.c_str());
+  fprintf(f, "%d %d %d %ld %ld %ld %s %s\n",
+          entry.time_ms, entry.usage.user_ms, entry.usage.system_ms,
+          entry.usage.max_rss_kb, entry.usage.in_blocks,
+          entry.usage.out_blocks, entry.output.c_str(),
+          entry.command.c_str());
+}
+
+void BuildLog::WriteBinaryEntry(FILE* f, const LogEntry& entry) {
+  BinaryRecord record = MakeRecord(entry);
+  fwrite(&record, sizeof(record), 1, f);
+  fwrite(entry.output.data(), 1, entry.output.size(), f);
+  fwrite(entry.command.data(), 1, entry.command.size(), f);
+  Pad8(f, sizeof(record) + entry.output.size() + entry.command.size());
+  // Write each entry whole, as the text log's line buffering does.
+  fflush(f);
+}
+
+bool BuildLog::WriteBinarySnapshot(FILE* f, string* err) {
+  DecodeAll();
+
+  // Keep the index at most half full, so that probes stay short.
+  uint32_t index_size = 2;
+  while (index_size < 2 * log_.size()) {
+    if (index_size >= (1u << 31)) {
+      *err = "too many entries for a binary log";
+      return false;
+    }
+    index_size *= 2;
+  }
+
+  vector<BinaryRecord> records;
+  vector<uint32_t> index(index_size, 0);
+  string strings;
+  for (Log::iterator i = log_.begin(); i != log_.end(); ++i) {
+    const LogEntry& entry = *i->second;
+    if (strings.size() + entry.output.size() + entry.command.size() >
+        UINT32_MAX) {
+      *err = "commands too long for a binary log";
+      return false;
+    }
+    BinaryRecord record = MakeRecord(entry);
+    record.output = strings.size();
+    strings += entry.output;
+    record.command = strings.size();
+    strings += entry.command;
+    records.push_back(record);
+
+    uint32_t slot = record.hash & (index_size - 1);
+    while (index[slot])
+      slot = (slot + 1) & (index_size - 1);
+    index[slot] = records.size();
+  }
+
+  BinaryHeader header;
+  memcpy(header.magic, kBinaryMagic, sizeof(header.magic));
+  header.version = kBinaryVersion;
+  header.record_count = records.size();
+  header.index_size = index_size;
+  header.strings_size = strings.size();
+  fwrite(&header, sizeof(header), 1, f);
+  if (!records.empty())
+    fwrite(&records[0], sizeof(BinaryRecord), records.size(), f);
+  fwrite(&index[0], sizeof(uint32_t), index.size(), f);
+  fwrite(strings.data(), 1, strings.size(), f);
+  Pad8(f, strings.size());
+  return true;
 }
 
 bool BuildLog::Recompact(const string& path, string* err) {
@@ -154,8 +519,18 @@ bool BuildLog::Recompact(const string& path, string* err) {
     return false;
   }
 
-  for (Log::iterator i = log_.begin(); i != log_.end(); ++i) {
-    WriteEntry(f, *i->second);
+  if (binary_) {
+    if (!WriteBinarySnapshot(f, err)) {
+      fclose(f);
+      unlink(temp_path.c_str());
+      return false;
+    }
+  } else {
+    DecodeAll();
+    fprintf(f, kFileSignature, kCurrentVersion);
+    for (Log::iterator i = log_.begin(); i != log_.end(); ++i) {
+      WriteEntry(f, *i->second);
+    }
   }
 
   fclose(f);
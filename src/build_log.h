@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdint.h>
+#include <stdio.h>
+
 #include <map>
 #include <string>
 using namespace std;
@@ -19,6 +22,19 @@ using namespace std;
 struct BuildConfig;
 struct Edge;
 
+// Resources used by a command and the processes it waited for, as
+// reported by wait4().  All zero when unknown.
+struct ResourceUsage {
+  ResourceUsage() : user_ms(0), system_ms(0), max_rss_kb(0), in_blocks(0),
+                    out_blocks(0) {}
+  int user_ms;
+  int system_ms;
+  long max_rss_kb;
+  // Block I/O operations (reads from and writes to disk).
+  long in_blocks;
+  long out_blocks;
+};
+
 // Store a log of every command ran for every build.
 // It has a few uses:
 // 1) historical command lines for output files, so we know
@@ -26,38 +42,88 @@ struct Edge;
 // 2) historical timing information
 // 3) maybe we can generate some sort of build overview output
 //    from it
+//
+// The log is either text, one line per command, or binary: an indexed
+// snapshot that is mapped rather than parsed on load, followed by the
+// commands run since.  Entries of a binary log are only decoded when
+// they're looked up.  New logs are text; "ninja -t convertlog" switches
+// an existing log between the two.
 struct BuildLog {
   BuildLog();
+  ~BuildLog();
 
   void SetConfig(BuildConfig* config) { config_ = config; }
   bool OpenForWrite(const string& path, string* err);
-  void RecordCommand(Edge* edge, int time_ms);
+  // Record that |edge| ran; |usage| may be NULL if it wasn't measured.
+  void RecordCommand(Edge* edge, int time_ms,
+                     const ResourceUsage* usage = NULL);
   void Close();
 
-  // Load the on-disk log.
+  // Load the on-disk log, in either format.
   bool Load(const string& path, string* err);
 
   struct LogEntry {
     string output;
     string command;
     int time_ms;
+    ResourceUsage usage;
     bool operator==(const LogEntry& o) {
-      return output == o.output && command == o.command && time_ms == o.time_ms;
+      return output == o.output && command == o.command &&
+          time_ms == o.time_ms && usage.user_ms == o.usage.user_ms &&
+          usage.system_ms == o.usage.system_ms &&
+          usage.max_rss_kb == o.usage.max_rss_kb &&
+          usage.in_blocks == o.usage.in_blocks &&
+          usage.out_blocks == o.usage.out_blocks;
     }
   };
 
   // Lookup a previously-run command by its output path.
   LogEntry* LookupByOutput(const string& path);
+  // Decode every entry of a binary log into log_, to go through them all.
+  void DecodeAll();
 
   // Serialize an entry into a log file.
   void WriteEntry(FILE* f, const LogEntry& entry);
 
-  // Rewrite the known log entries, throwing away old data.
+  // Rewrite the known log entries, throwing away old data, in the binary
+  // format if binary_ is set.
   bool Recompact(const string& path, string* err);
 
+  // Entries loaded from a text log or the commands appended to a binary
+  // one, those recorded since, and those decoded from the mapped file.
   typedef map<string, LogEntry*> Log;
   Log log_;
   FILE* log_file_;
   BuildConfig* config_;
   bool needs_recompaction_;
+  // Format version of the file that was loaded (0 if there was none).
+  int log_version_;
+  // Whether the log is (or is to be written) in the binary format.
+  bool binary_;
+
+  // The layout of the binary format, in build_log.cc.
+  struct BinaryHeader;
+  struct BinaryRecord;
+
+private:
+  bool LoadBinary(int fd, string* err);
+  // Decode the |index|th record of the mapped snapshot, or return NULL
+  // if it's corrupt.
+  LogEntry* DecodeRecord(uint32_t index);
+  bool WriteBinarySnapshot(FILE* f, string* err);
+  void WriteBinaryEntry(FILE* f, const LogEntry& entry);
+
+  // The mapped binary log, if one was loaded.
+  char* map_;
+  size_t map_size_;
+  // The snapshot's records, hash index and strings, within map_.
+  const BinaryRecord* records_;
+  uint32_t record_count_;
+  const uint32_t* index_;
+  uint32_t index_size_;
+  const char* strings_;
+  uint32_t strings_size_;
+  // Where the last complete appended entry ends; a crash can leave a
+  // partial one after it.
+  size_t binary_end_;
 };
@@ -0,0 +1,102 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures loading a large build log in the text and binary formats, and
+// then looking up some or all of its entries.
+// Usage: build_log_perftest [entries [lookups]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "build_log.h"
+
+namespace {
+
+const char kLogPath[] = "BuildLogPerfTest-tempfile";
+
+double Now() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+string OutputPath(int i) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "obj/dir%d/file%d.o", i % 100, i);
+  return buf;
+}
+
+// Write a text log of |count| compile commands, like a big C++ tree's.
+void WriteTextLog(int count) {
+  FILE* f = fopen(kLogPath, "wb");
+  fprintf(f, "# ninja log v2\n");
+  string flags;
+  for (int i = 0; i < 40; ++i)
+    flags += " -Ithird_party/some/include/dir";
+  for (int i = 0; i < count; ++i) {
+    string output = OutputPath(i);
+    fprintf(f, "%d 900 100 65536 0 8 %s g++ -MMD -MF %s.d%s -c src/%d.cc "
+            "-o %s\n", i % 5000, output.c_str(), output.c_str(),
+            flags.c_str(), i, output.c_str());
+  }
+  fclose(f);
+}
+
+void TimeLoad(const char* format, int count, int lookups) {
+  double start = Now();
+  BuildLog log;
+  string err;
+  if (!log.Load(kLogPath, &err)) {
+    fprintf(stderr, "load: %s\n", err.c_str());
+    exit(1);
+  }
+  double loaded = Now();
+  int found = 0;
+  for (int i = 0; i < lookups; ++i) {
+    if (log.LookupByOutput(OutputPath(i * (count / lookups))))
+      ++found;
+  }
+  double done = Now();
+  printf("%-6s  load %7.1fms  %d lookups %7.1fms  (%d found)\n", format,
+         (loaded - start) * 1000, lookups, (done - loaded) * 1000, found);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 1000000;
+  int lookups = argc > 2 ? atoi(argv[2]) : count / 10;
+  if (count <= 0 || lookups <= 0 || lookups > count) {
+    fprintf(stderr, "usage: build_log_perftest [entries [lookups]]\n");
+    return 1;
+  }
+
+  WriteTextLog(count);
+  TimeLoad("text", count, lookups);
+
+  BuildLog log;
+  string err;
+  log.Load(kLogPath, &err);
+  log.binary_ = true;
+  if (!log.Recompact(kLogPath, &err)) {
+    fprintf(stderr, "convert: %s\n", err.c_str());
+    return 1;
+  }
+  TimeLoad("binary", count, lookups);
+
+  unlink(kLogPath);
+  return 0;
+}
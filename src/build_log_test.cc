@@ -35,7 +35,13 @@ TEST_F(BuildLogTest, WriteRead) {
   string err;
   EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
   ASSERT_EQ("", err);
-  log1.RecordCommand(state_.edges_[0], 15);
+  ResourceUsage usage;
+  usage.user_ms = 12;
+  usage.system_ms = 3;
+  usage.max_rss_kb = 65536;
+  usage.in_blocks = 8;
+  usage.out_blocks = 16;
+  log1.RecordCommand(state_.edges_[0], 15, &usage);
   log1.RecordCommand(state_.edges_[1], 20);
   log1.Close();
 
@@ -52,6 +58,43 @@ TEST_F(BuildLogTest, WriteRead) {
   ASSERT_TRUE(*e1 == *e2);
   ASSERT_EQ(15, e1->time_ms);
   ASSERT_EQ("out", e1->output);
+  EXPECT_EQ(12, e2->usage.user_ms);
+  EXPECT_EQ(65536, e2->usage.max_rss_kb);
+  EXPECT_EQ(16, e2->usage.out_blocks);
+  EXPECT_EQ(0, log2.LookupByOutput("mid")->usage.max_rss_kb);
+}
+
+TEST_F(BuildLogTest, UpgradeVersion1) {
+  AssertParse(&state_,
+"build out: cat in\n");
+
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "5 old command abc\n");
+  fclose(f);
+
+  string err;
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log.LookupByOutput("old");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(5, e->time_ms);
+  EXPECT_EQ("command abc", e->command);
+
+  // Appending to an old log rewrites it in the current format first.
+  EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log.RecordCommand(state_.edges_[0], 7);
+  log.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(2, log2.log_version_);
+  ASSERT_TRUE(log2.LookupByOutput("old"));
+  EXPECT_EQ("command abc", log2.LookupByOutput("old")->command);
+  ASSERT_TRUE(log2.LookupByOutput("out"));
+  EXPECT_EQ(7, log2.LookupByOutput("out")->time_ms);
 }
 
 TEST_F(BuildLogTest, DoubleEntry) {
@@ -69,3 +112,129 @@ TEST_F(BuildLogTest, DoubleEntry) {
   ASSERT_TRUE(e);
   ASSERT_EQ("command def", e->command);
 }
+
+TEST_F(BuildLogTest, LongCommand) {
+  // Longer than any fixed line buffer.
+  string command(1 << 20, 'x');
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v2\n");
+  fprintf(f, "1 0 0 0 0 0 out %s\n", command.c_str());
+  fprintf(f, "2 0 0 0 0 0 out2 short");  // No final newline.
+  fclose(f);
+
+  string err;
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2, log.log_.size());
+  EXPECT_EQ(command, log.LookupByOutput("out")->command);
+  EXPECT_EQ("short", log.LookupByOutput("out2")->command);
+}
+
+TEST_F(BuildLogTest, Binary) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n");
+
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  ResourceUsage usage;
+  usage.max_rss_kb = 65536;
+  log1.RecordCommand(state_.edges_[0], 15, &usage);
+  log1.RecordCommand(state_.edges_[1], 20);
+  log1.Close();
+
+  // Convert it.
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  log2.binary_ = true;
+  EXPECT_TRUE(log2.Recompact(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  // Entries are only decoded as they're looked up.
+  BuildLog log3;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(3, log3.log_version_);
+  EXPECT_TRUE(log3.binary_);
+  EXPECT_EQ(0, log3.log_.size());
+  BuildLog::LogEntry* e = log3.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_TRUE(*log1.LookupByOutput("out") == *e);
+  EXPECT_EQ(65536, e->usage.max_rss_kb);
+  EXPECT_EQ(1, log3.log_.size());
+  EXPECT_FALSE(log3.LookupByOutput("in"));
+  EXPECT_EQ(20, log3.LookupByOutput("mid")->time_ms);
+
+  // New commands are appended in binary, and win over the snapshot.
+  EXPECT_TRUE(log3.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log3.RecordCommand(state_.edges_[0], 30);
+  log3.Close();
+
+  BuildLog log4;
+  EXPECT_TRUE(log4.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(30, log4.LookupByOutput("out")->time_ms);
+  EXPECT_EQ(20, log4.LookupByOutput("mid")->time_ms);
+  EXPECT_FALSE(log4.needs_recompaction_);
+
+  // And back to text.
+  log4.binary_ = false;
+  EXPECT_TRUE(log4.Recompact(kTestFilename, &err));
+  BuildLog log5;
+  EXPECT_TRUE(log5.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(2, log5.log_version_);
+  EXPECT_EQ(2, log5.log_.size());
+  EXPECT_EQ(30, log5.LookupByOutput("out")->time_ms);
+  EXPECT_EQ("cat in > mid", log5.LookupByOutput("mid")->command);
+}
+
+TEST_F(BuildLogTest, BinaryTruncatedEntry) {
+  AssertParse(&state_,
+"build out: cat in\n");
+
+  string err;
+  {
+    BuildLog log;
+    log.binary_ = true;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    log.RecordCommand(state_.edges_[0], 10);
+    log.Close();
+  }
+  {
+    // Put that in the snapshot and append another.
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    EXPECT_TRUE(log.needs_recompaction_);
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    log.RecordCommand(state_.edges_[0], 15);
+    log.Close();
+  }
+
+  // A crash leaves half an entry at the end.
+  FILE* f = fopen(kTestFilename, "ab");
+  fwrite("\x10\0\0\0", 1, 4, f);
+  fclose(f);
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(log.needs_recompaction_);
+  EXPECT_EQ(15, log.LookupByOutput("out")->time_ms);
+  // It's dropped before anything more is appended.
+  EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  log.RecordCommand(state_.edges_[0], 25);
+  log.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(25, log2.LookupByOutput("out")->time_ms);
+}
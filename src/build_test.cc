@@ -14,7 +14,11 @@
 
 #include "build.h"
 
+#include <signal.h>
+
+#include "build_log.h"
 #include "test.h"
+#include "util.h"
 
 // Though Plan doesn't use State, it's useful to have one around
 // to create Nodes and Edges.
@@ -187,6 +191,187 @@ TEST_F(PlanTest, DependencyCycle) {
   ASSERT_EQ("dependency cycle: out -> mid -> in -> pre -> out", err);
 }
 
+TEST_F(PlanTest, DependencyCycleThroughOtherOutput) {
+  // The edge making out1 and out2 needs out2, via mid.
+  AssertParse(&state_,
+"build out1 out2: cat mid\n"
+"build mid: cat out2\n");
+  GetNode("out1")->dirty_ = true;
+  GetNode("out2")->dirty_ = true;
+  GetNode("mid")->dirty_ = true;
+
+  string err;
+  EXPECT_FALSE(plan_.AddTarget(GetNode("out1"), &err));
+  ASSERT_EQ("dependency cycle: out1 -> mid -> out2", err);
+}
+
+TEST_F(PlanTest, DeepChain) {
+  // Deep enough to overflow the stack if plan construction recursed.
+  const int kDepth = 100000;
+  Rule* rule = new Rule("chain");
+  string err;
+  ASSERT_TRUE(rule->ParseCommand("cat $in > $out", &err));
+  state_.AddRule(rule);
+  char in[32] = "in", out[32];
+  for (int i = 0; i < kDepth; ++i) {
+    Edge* edge = state_.AddEdge(rule);
+    state_.AddIn(edge, in);
+    sprintf(out, "n%d", i);
+    state_.AddOut(edge, out);
+    GetNode(out)->dirty_ = true;
+    strcpy(in, out);
+  }
+
+  EXPECT_TRUE(plan_.AddTarget(GetNode(in), &err));
+  ASSERT_EQ("", err);
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("n0", edge->outputs_[0]->file_->path_);
+  EXPECT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, CriticalPath) {
+  AssertParse(&state_,
+"build short: cat in\n"
+"build long1: cat in\n"
+"build long2: cat long1\n"
+"build out: cat short long2\n");
+  GetNode("short")->dirty_ = true;
+  GetNode("long1")->dirty_ = true;
+  GetNode("long2")->dirty_ = true;
+  GetNode("out")->dirty_ = true;
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  // Without history every step costs the same, so the longer chain wins
+  // even though "short" comes first in the manifest.
+  plan_.ComputeCriticalPath(NULL);
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("long1", edge->outputs_[0]->file_->path_);
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("short", edge->outputs_[0]->file_->path_);
+}
+
+TEST_F(PlanTest, CriticalPathFromLog) {
+  AssertParse(&state_,
+"build short: cat in\n"
+"build long1: cat in\n"
+"build long2: cat long1\n"
+"build out: cat short long2\n");
+  GetNode("short")->dirty_ = true;
+  GetNode("long1")->dirty_ = true;
+  GetNode("long2")->dirty_ = true;
+  GetNode("out")->dirty_ = true;
+
+  // "short" is a single step, but it is slower than the whole other chain.
+  BuildLog log;
+  const char* outputs[] = { "short", "long1", "long2" };
+  const int times[] = { 100, 10, 10 };
+  for (int i = 0; i < 3; ++i) {
+    BuildLog::LogEntry* entry = new BuildLog::LogEntry;
+    entry->output = outputs[i];
+    entry->time_ms = times[i];
+    log.log_[entry->output] = entry;
+  }
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+  plan_.ComputeCriticalPath(&log);
+
+  // "out" has no history and is estimated at the average, 40ms.
+  EXPECT_EQ(140, GetNode("short")->in_edge_->critical_time_ms_);
+  EXPECT_EQ(60, GetNode("long1")->in_edge_->critical_time_ms_);
+  EXPECT_TRUE(plan_.has_timings());
+  EXPECT_EQ(160, plan_.remaining_time_ms());
+  EXPECT_EQ(140, plan_.ready_critical_time_ms());
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("short", edge->outputs_[0]->file_->path_);
+  EXPECT_EQ(60, plan_.ready_critical_time_ms());
+
+  // Finished edges no longer count toward the time left.
+  GetNode("short")->dirty_ = false;
+  plan_.EdgeFinished(edge);
+  EXPECT_EQ(60, plan_.remaining_time_ms());
+}
+
+TEST_F(PlanTest, PoolWithDepthOne) {
+  AssertParse(&state_,
+"pool one\n"
+"  depth = 1\n"
+"rule slow\n"
+"  command = slow $in > $out\n"
+"  pool = one\n"
+"build out1: slow in\n"
+"build out2: slow in\n"
+"build other: cat in\n"
+"build all: phony out1 out2 other\n");
+  GetNode("out1")->dirty_ = true;
+  GetNode("out2")->dirty_ = true;
+  GetNode("other")->dirty_ = true;
+  GetNode("all")->dirty_ = true;
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  // Only one edge from the pool may run, but it doesn't block "other".
+  Edge* edge1 = plan_.FindWork();
+  ASSERT_TRUE(edge1);
+  EXPECT_EQ("out1", edge1->outputs_[0]->file_->path_);
+  Edge* edge2 = plan_.FindWork();
+  ASSERT_TRUE(edge2);
+  EXPECT_EQ("other", edge2->outputs_[0]->file_->path_);
+  EXPECT_FALSE(plan_.FindWork());
+  EXPECT_EQ(1, edge1->pool_->current_use_);
+
+  // Finishing the first pool edge lets the second one go.
+  GetNode("out1")->dirty_ = false;
+  plan_.EdgeFinished(edge1);
+  Edge* edge3 = plan_.FindWork();
+  ASSERT_TRUE(edge3);
+  EXPECT_EQ("out2", edge3->outputs_[0]->file_->path_);
+  EXPECT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, EdgeFailedDropsDependents) {
+  AssertParse(&state_,
+"build mid: cat in\n"
+"build out: cat mid\n"
+"build other: cat in\n"
+"build all: phony out other\n");
+  GetNode("mid")->dirty_ = true;
+  GetNode("out")->dirty_ = true;
+  GetNode("other")->dirty_ = true;
+  GetNode("all")->dirty_ = true;
+
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("all"), &err));
+  ASSERT_EQ("", err);
+
+  Edge* mid = plan_.FindWork();
+  ASSERT_TRUE(mid);
+  EXPECT_EQ("mid", mid->outputs_[0]->file_->path_);
+  Edge* other = plan_.FindWork();
+  ASSERT_TRUE(other);
+  EXPECT_EQ("other", other->outputs_[0]->file_->path_);
+
+  // "out" and the phony "all" can never run now; only "out" has a command.
+  EXPECT_EQ(1, plan_.EdgeFailed(mid));
+  EXPECT_TRUE(plan_.more_to_do());
+  EXPECT_FALSE(plan_.FindWork());
+
+  GetNode("other")->dirty_ = false;
+  plan_.EdgeFinished(other);
+  EXPECT_FALSE(plan_.more_to_do());
+}
+
 struct VirtualFileSystem : public DiskInterface {
   struct Entry {
     int mtime;
@@ -228,6 +413,7 @@ struct BuildTest : public StateTestWithBuiltinRules,
   BuildTest() : config_(MakeConfig()), builder_(&state_, config_), now_(1),
                 last_command_(NULL) {
     builder_.disk_interface_ = &fs_;
+    delete builder_.command_runner_;
     builder_.command_runner_ = this;
     AssertParse(&state_,
 "build cat1: cat in1\n"
@@ -244,8 +430,8 @@ struct BuildTest : public StateTestWithBuiltinRules,
   // CommandRunner impl
   virtual bool CanRunMore();
   virtual bool StartCommand(Edge* edge);
-  virtual bool WaitForCommands();
-  virtual Edge* NextFinishedCommand(bool* success);
+  virtual bool WaitForCommands(int timeout_ms);
+  virtual Edge* NextFinishedCommand(bool* success, ResourceUsage* usage);
 
   BuildConfig MakeConfig() {
     BuildConfig config;
@@ -281,11 +467,29 @@ bool BuildTest::CanRunMore() {
 bool BuildTest::StartCommand(Edge* edge) {
   assert(!last_command_);
   commands_ran_.push_back(edge->EvaluateCommand());
+  if (edge->rule_->name_ == "fail") {
+    last_command_ = edge;
+    return true;
+  }
   if (edge->rule_->name_ == "cat" || edge->rule_->name_ == "cc") {
     for (vector<Node*>::iterator out = edge->outputs_.begin();
          out != edge->outputs_.end(); ++out) {
       (*out)->file_->mtime_ = now_;
       (*out)->dirty_ = false;
+      fs_.Create((*out)->file_->path_, now_, "");
+    }
+    last_command_ = edge;
+    return true;
+  } else if (edge->rule_->name_ == "interrupt") {
+    // As if the user hit ^C while this ran.
+    raise(SIGINT);
+    last_command_ = edge;
+    return true;
+  } else if (edge->rule_->name_ == "touch") {
+    // Like a real command, change only the disk, not the stat cache.
+    for (vector<Node*>::iterator out = edge->outputs_.begin();
+         out != edge->outputs_.end(); ++out) {
+      fs_.Create((*out)->file_->path_, now_, "");
     }
     last_command_ = edge;
     return true;
@@ -296,13 +500,13 @@ bool BuildTest::StartCommand(Edge* edge) {
   return false;
 }
 
-bool BuildTest::WaitForCommands() {
+bool BuildTest::WaitForCommands(int timeout_ms) {
   return true;
 }
 
-Edge* BuildTest::NextFinishedCommand(bool* success) {
+Edge* BuildTest::NextFinishedCommand(bool* success, ResourceUsage* usage) {
   if (Edge* edge = last_command_) {
-    *success = true;
+    *success = edge->rule_->name_ != "fail";
     last_command_ = NULL;
     return edge;
   }
@@ -545,3 +749,179 @@ TEST_F(BuildTest, Phony) {
   ASSERT_NE("", err);
 }
 
+
+TEST_F(BuildTest, StopAfterFailure) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule fail\n"
+"  command = fail\n"
+"build out1: fail\n"
+"build out2: fail\n"
+"build all: phony out1 out2\n"));
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("subcommand failed", err);
+  EXPECT_EQ(1u, commands_ran_.size());
+}
+
+TEST_F(BuildTest, KeepGoing) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule fail\n"
+"  command = fail\n"
+"build bad1: fail\n"
+"build bad2: fail\n"
+"build bad3: fail\n"
+"build after: cat bad1\n"
+"build good: cat in1\n"
+"build all: phony bad1 bad2 bad3 after good\n"));
+  builder_.failures_allowed_ = 2;
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+
+  // The build stops starting commands after the second failure; "after"
+  // never runs because its input failed.
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("2 subcommands failed", err);
+  ASSERT_EQ(2u, builder_.failed_edges_.size());
+  EXPECT_EQ(1, builder_.skipped_edges_);
+  for (vector<string>::iterator i = commands_ran_.begin();
+       i != commands_ran_.end(); ++i) {
+    EXPECT_NE("cat bad1 > after", *i);
+  }
+}
+
+TEST_F(BuildTest, KeepGoingRunsIndependentWork) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule fail\n"
+"  command = fail\n"
+"build bad: fail\n"
+"build after: cat bad\n"
+"build good: cat in1\n"
+"build all: phony after good\n"));
+  builder_.failures_allowed_ = 10;
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("all", &err));
+  ASSERT_EQ("", err);
+
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("subcommand failed", err);
+  ASSERT_EQ(2u, commands_ran_.size());
+  EXPECT_EQ("cat in1 > good", commands_ran_[1]);
+  EXPECT_FALSE(GetNode("good")->dirty_);
+}
+
+TEST_F(BuildTest, OneFileMode) {
+  // "in1^" builds what in1 is a direct input of, and nothing downstream.
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("in1^", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, commands_ran_.size());
+  EXPECT_EQ("cat in1 > cat1", commands_ran_[0]);
+  EXPECT_EQ("cat in1 in2 > cat2", commands_ran_[1]);
+
+  EXPECT_FALSE(builder_.AddTarget("cat12^", &err));
+  EXPECT_EQ("'cat12' is not an input of any build statement", err);
+  err.clear();
+  EXPECT_FALSE(builder_.AddTarget("nonexistent^", &err));
+  EXPECT_EQ("unknown target: 'nonexistent^'", err);
+}
+
+TEST_F(BuildTest, MakeDirsOnce) {
+  string err;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out/a/1: cat in1\n"
+"build out/a/2: cat in1\n"
+"build out/b/1: cat in1\n"));
+  fs_.Create("out", now_, "");
+
+  EXPECT_TRUE(builder_.AddTarget("out/a/1", &err));
+  EXPECT_TRUE(builder_.AddTarget("out/a/2", &err));
+  EXPECT_TRUE(builder_.AddTarget("out/b/1", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+
+  // "out" exists; its subdirectories are each created once even though
+  // nothing tells the stat cache they exist afterwards.
+  ASSERT_EQ(2u, fs_.directories_made_.size());
+  EXPECT_EQ("out/a", fs_.directories_made_[0]);
+  EXPECT_EQ("out/b", fs_.directories_made_[1]);
+}
+
+TEST_F(BuildTest, MakeDirsOnlyForEdgesThatRun) {
+  string err;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule fail\n"
+"  command = fail\n"
+"build out/a: fail in1\n"
+"build out/b: cat in1\n"
+"build gen/c: cat out/a out/b\n"));
+
+  EXPECT_TRUE(builder_.AddTarget("gen/c", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("subcommand failed", err);
+
+  // gen/c never starts, so "gen" isn't created.
+  ASSERT_EQ(1u, fs_.directories_made_.size());
+  EXPECT_EQ("out", fs_.directories_made_[0]);
+}
+
+TEST_F(BuildTest, MakeDirsForDirectoryOutput) {
+  string err;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = touch $out\n"
+"build gen: touch\n"
+"build gen/x: touch || gen\n"));
+
+  // The scan finds "gen" missing, but building it makes it...
+  EXPECT_TRUE(builder_.AddTarget("gen/x", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, commands_ran_.size());
+  // So it isn't created again for gen/x.
+  EXPECT_EQ(0u, fs_.directories_made_.size());
+}
+
+TEST_F(BuildTest, Interrupted) {
+  string err;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule interrupt\n"
+"  command = interrupt\n"
+"build mid: interrupt in1\n"
+"build out: cat mid\n"));
+  fs_.Create("in1", now_, "");
+
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("interrupted by user", err);
+  // Nothing starts once ^C arrives.
+  EXPECT_EQ(1u, commands_ran_.size());
+}
+
+TEST_F(BuildTest, ExplainUnstatableOutput) {
+  string err;
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = touch $out\n"
+"build out: touch\n"));
+  // As if stat() failed with something other than ENOENT.
+  fs_.Create("out", -1, "");
+
+  g_explaining = true;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  g_explaining = false;
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(GetNode("out")->dirty_);
+}
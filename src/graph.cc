@@ -19,6 +19,7 @@
 #include "build_log.h"
 #include "ninja.h"
 #include "parsers.h"
+#include "util.h"
 
 bool FileStat::Stat(DiskInterface* disk_interface) {
   mtime_ = disk_interface->Stat(path_);
@@ -35,6 +36,7 @@ bool Edge::RecomputeDirty(State* state, DiskInterface* disk_interface,
   }
 
   time_t most_recent_input = 1;
+  Node* most_recent_node = NULL;
   for (vector<Node*>::iterator i = inputs_.begin(); i != inputs_.end(); ++i) {
     if ((*i)->file_->StatIfNecessary(disk_interface)) {
       if (Edge* edge = (*i)->in_edge_) {
@@ -43,25 +45,42 @@ bool Edge::RecomputeDirty(State* state, DiskInterface* disk_interface,
       } else {
         // This input has no in-edge; it is dirty if it is missing.
         // But it's ok for implicit deps to be missing.
-        if (!is_implicit(i - inputs_.begin()))
+        if (!is_implicit(i - inputs_.begin())) {
           (*i)->dirty_ = !(*i)->file_->exists();
+          if ((*i)->dirty_) {
+            EXPLAIN("%s has no in-edge and is missing",
+                    (*i)->file_->path_.c_str());
+          }
+        }
       }
     }
 
     if (is_order_only(i - inputs_.begin())) {
       // Order-only deps only make us dirty if they're missing.
-      if (!(*i)->file_->exists())
+      if (!(*i)->file_->exists()) {
+        if (!dirty) {
+          EXPLAIN("order-only input %s of %s is missing",
+                  (*i)->file_->path_.c_str(),
+                  outputs_[0]->file_->path_.c_str());
+        }
         dirty = true;
+      }
       continue;
     }
 
     // If a regular input is dirty (or missing), we're dirty.
     // Otherwise consider mtime.
     if ((*i)->dirty_) {
+      if (!dirty) {
+        EXPLAIN("input %s of %s is dirty", (*i)->file_->path_.c_str(),
+                outputs_[0]->file_->path_.c_str());
+      }
       dirty = true;
     } else {
-      if ((*i)->file_->mtime_ > most_recent_input)
+      if ((*i)->file_->mtime_ > most_recent_input) {
         most_recent_input = (*i)->file_->mtime_;
+        most_recent_node = *i;
+      }
     }
   }
 
@@ -75,16 +94,30 @@ bool Edge::RecomputeDirty(State* state, DiskInterface* disk_interface,
 
     // Output is dirty if we're dirty, we're missing the output,
     // or if it's older than the most recent input mtime.
-    if (dirty || !(*i)->file_->exists() ||
-        (*i)->file_->mtime_ < most_recent_input) {
+    if (dirty) {
+      (*i)->dirty_ = true;
+    } else if (!(*i)->file_->exists()) {
+      EXPLAIN("output %s doesn't exist", (*i)->file_->path_.c_str());
+      (*i)->dirty_ = true;
+    } else if (!(*i)->file_->status_known()) {
+      // Stat() failed; there may be no input to compare it with.
+      EXPLAIN("output %s couldn't be stat'ed", (*i)->file_->path_.c_str());
+      (*i)->dirty_ = true;
+    } else if ((*i)->file_->mtime_ < most_recent_input) {
+      EXPLAIN("output %s older than most recent input %s (%ld vs %ld)",
+              (*i)->file_->path_.c_str(),
+              most_recent_node->file_->path_.c_str(),
+              (long)(*i)->file_->mtime_, (long)most_recent_input);
       (*i)->dirty_ = true;
     } else {
       // May also be dirty due to the command changing since the last build.
       BuildLog::LogEntry* entry;
       if (state->build_log_ &&
           (entry = state->build_log_->LookupByOutput((*i)->file_->path_))) {
-        if (command != entry->command)
+        if (command != entry->command) {
+          EXPLAIN("command line changed for %s", (*i)->file_->path_.c_str());
           (*i)->dirty_ = true;
+        }
       }
     }
   }
@@ -124,9 +157,13 @@ string Edge::GetDescription() {
   return rule_->description_.Evaluate(&env);
 }
 
-bool Edge::LoadDepFile(State* state, DiskInterface* disk_interface, string* err) {
+string Edge::EvaluateDepFile() {
   EdgeEnv env(this);
-  string path = rule_->depfile_.Evaluate(&env);
+  return rule_->depfile_.Evaluate(&env);
+}
+
+bool Edge::LoadDepFile(State* state, DiskInterface* disk_interface, string* err) {
+  string path = EvaluateDepFile();
 
   string content = disk_interface->ReadFile(path, err);
   if (!err->empty())
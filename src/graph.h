@@ -68,7 +68,7 @@ struct Node {
 };
 
 struct Rule {
-  Rule(const string& name) : name_(name) { }
+  Rule(const string& name) : name_(name), timeout_(0) { }
 
   bool ParseCommand(const string& command, string* err) {
     return command_.Parse(command, err);
@@ -77,20 +77,53 @@ struct Rule {
   EvalString command_;
   EvalString description_;
   EvalString depfile_;
+  // Name of the pool edges of this rule run in, if any; evaluated in
+  // each edge's scope.
+  EvalString pool_;
+  // Kill commands that run longer than this many seconds (if > 0).
+  int timeout_;
+};
+
+struct Edge;
+
+// A Pool caps how many of the edges assigned to it may run at once, on
+// top of the global -j limit.  Edges that reach the front of the ready
+// queue while their pool is full wait in delayed_, without holding up
+// ready edges from other pools.
+struct Pool {
+  Pool(const string& name, int depth)
+      : name_(name), depth_(depth), current_use_(0) {}
+
+  bool full() const { return current_use_ >= depth_; }
+
+  string name_;
+  int depth_;
+  // Number of this pool's edges handed out and not yet finished.
+  int current_use_;
+  // Edges waiting for a free slot, as a heap in the same order as
+  // Plan::ready_.
+  vector<Edge*> delayed_;
 };
 
 struct State;
 struct Edge {
-  Edge() : rule_(NULL), env_(NULL), implicit_deps_(0), order_only_deps_(0) {}
+  Edge() : rule_(NULL), pool_(NULL), env_(NULL), implicit_deps_(0),
+           order_only_deps_(0), id_(-1), plan_state_(kNotWanted),
+           pending_inputs_(0), on_plan_stack_(false), estimate_ms_(0),
+           critical_time_ms_(0) {}
 
   bool RecomputeDirty(State* state, DiskInterface* disk_interface, string* err);
   string EvaluateCommand();  // XXX move to env, take env ptr
   string GetDescription();
+  // The path of the depfile, or "" if the rule has none.
+  string EvaluateDepFile();
   bool LoadDepFile(State* state, DiskInterface* disk_interface, string* err);
 
   void Dump();
 
   const Rule* rule_;
+  // The pool this edge runs in, or NULL if only -j limits it.
+  Pool* pool_;
   vector<Node*> inputs_;
   vector<Node*> outputs_;
   Env* env_;
@@ -117,6 +150,30 @@ struct Edge {
   }
 
   bool is_phony() const;
+
+  // Dense index of this edge in State::edges_.
+  int id_;
+
+  // Bookkeeping owned by Plan: where this edge is in the current plan, and
+  // how many of its inputs are produced by planned edges that haven't
+  // finished yet.
+  enum PlanState {
+    kNotWanted,  // Not part of the plan (or already finished).
+    kWaiting,    // Wanted, but some inputs are still being built.
+    kReady,      // All inputs done; queued in Plan::ready_.
+    kScheduled   // Handed out by Plan::FindWork.
+  };
+  PlanState plan_state_;
+  int pending_inputs_;
+  // True while Plan::AddTarget is adding this edge's inputs; reaching the
+  // edge again in that time means there is a dependency cycle.
+  bool on_plan_stack_;
+  // Expected run time of this edge, from the build log if possible.
+  int estimate_ms_;
+  // Estimated time from starting this edge until the end of the longest
+  // chain of planned edges that depends on it, including itself.  Plan
+  // hands out the ready edge with the largest value first.
+  int critical_time_ms_;
 };
 
 #endif  // NINJA_GRAPH_H_
@@ -0,0 +1,175 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+
+namespace {
+
+// Open our own description of the pipe behind |fd|, so that making it
+// non-blocking doesn't affect the other processes sharing the pipe.
+int ReopenNonBlocking(int fd) {
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+void CloseFd(int* fd) {
+  if (*fd >= 0)
+    close(*fd);
+  *fd = -1;
+}
+
+}  // anonymous namespace
+
+Jobserver::~Jobserver() {
+  ReleaseUnused(0);
+  CloseFd(&read_fd_);
+  CloseFd(&write_fd_);
+  CloseFd(&pipe_[0]);
+  CloseFd(&pipe_[1]);
+}
+
+bool Jobserver::ParseMakeflags(const string& makeflags, string* auth) {
+  // Newer makes say --jobserver-auth, older ones --jobserver-fds; both
+  // may be present, and the last one wins.
+  const char* kOptions[] = { "--jobserver-auth=", "--jobserver-fds=" };
+  string::size_type best = string::npos;
+  for (int i = 0; i < 2; ++i) {
+    string::size_type pos = makeflags.rfind(kOptions[i]);
+    if (pos == string::npos)
+      continue;
+    if (best != string::npos && pos < best)
+      continue;
+    best = pos;
+    pos += strlen(kOptions[i]);
+    string::size_type end = makeflags.find(' ', pos);
+    *auth = makeflags.substr(pos, end == string::npos ? end : end - pos);
+  }
+  return best != string::npos && !auth->empty();
+}
+
+bool Jobserver::Connect(const string& makeflags, string* err) {
+  string auth;
+  if (!ParseMakeflags(makeflags, &auth))
+    return false;
+
+  if (auth.compare(0, 5, "fifo:") == 0) {
+    string path = auth.substr(5);
+    read_fd_ = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (read_fd_ >= 0)
+      write_fd_ = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (read_fd_ < 0 || write_fd_ < 0) {
+      *err = "jobserver fifo " + path + ": " + strerror(errno);
+      CloseFd(&read_fd_);
+      return false;
+    }
+    return true;
+  }
+
+  int read_fd, write_fd;
+  if (sscanf(auth.c_str(), "%d,%d", &read_fd, &write_fd) != 2) {
+    *err = "can't parse jobserver description '" + auth + "'";
+    return false;
+  }
+  // make only passes the pipe to commands it knows are sub-makes; the
+  // descriptors may well be closed, or be something else entirely.
+  if (read_fd < 0 || write_fd < 0 || fcntl(read_fd, F_GETFD) < 0 ||
+      fcntl(write_fd, F_GETFD) < 0) {
+    *err = "jobserver pipe unavailable (mark the rule running ninja "
+           "with '+' in the Makefile)";
+    return false;
+  }
+  read_fd_ = ReopenNonBlocking(read_fd);
+  write_fd_ = fcntl(write_fd, F_DUPFD_CLOEXEC, 0);
+  if (read_fd_ < 0 || write_fd_ < 0) {
+    *err = string("jobserver pipe: ") + strerror(errno);
+    CloseFd(&read_fd_);
+    CloseFd(&write_fd_);
+    return false;
+  }
+  return true;
+}
+
+bool Jobserver::Create(int jobs, string* err) {
+  if (pipe(pipe_) < 0) {
+    *err = string("pipe: ") + strerror(errno);
+    return false;
+  }
+  // pipe_ stays inheritable, for the children.
+  read_fd_ = ReopenNonBlocking(pipe_[0]);
+  write_fd_ = fcntl(pipe_[1], F_DUPFD_CLOEXEC, 0);
+  if (read_fd_ < 0 || write_fd_ < 0) {
+    *err = string("jobserver pipe: ") + strerror(errno);
+    CloseFd(&read_fd_);
+    CloseFd(&write_fd_);
+    CloseFd(&pipe_[0]);
+    CloseFd(&pipe_[1]);
+    return false;
+  }
+  // We hold the first slot implicitly.
+  tokens_ = jobs - 1;
+  ReleaseUnused(0);
+
+  char flags[128];
+  snprintf(flags, sizeof(flags),
+           "-j%d --jobserver-fds=%d,%d --jobserver-auth=%d,%d", jobs,
+           pipe_[0], pipe_[1], pipe_[0], pipe_[1]);
+  string makeflags = flags;
+  if (const char* old = getenv("MAKEFLAGS")) {
+    if (*old)
+      makeflags = string(old) + " " + makeflags;
+  }
+  setenv("MAKEFLAGS", makeflags.c_str(), 1);
+  return true;
+}
+
+bool Jobserver::Acquire() {
+  char token;
+  ssize_t len;
+  do {
+    len = read(read_fd_, &token, 1);
+  } while (len < 0 && errno == EINTR);
+  if (len != 1)
+    return false;
+  ++tokens_;
+  return true;
+}
+
+void Jobserver::Release() {
+  // make's tokens are all '+'.
+  char token = '+';
+  ssize_t len;
+  do {
+    len = write(write_fd_, &token, 1);
+  } while (len < 0 && errno == EINTR);
+  if (len != 1)
+    Fatal("write to jobserver: %s", strerror(errno));
+  --tokens_;
+}
+
+void Jobserver::ReleaseUnused(int jobs) {
+  // The first job runs on our implicit slot.
+  int needed = jobs > 1 ? jobs - 1 : 0;
+  while (tokens_ > needed)
+    Release();
+}
@@ -0,0 +1,62 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_JOBSERVER_H_
+#define NINJA_JOBSERVER_H_
+
+#include <string>
+using namespace std;
+
+// GNU make's jobserver, which lets nested builds share one pool of job
+// slots.  The pool is a pipe (or named fifo) holding a byte, a "token",
+// for each slot beyond the first; every process in the build gets one
+// slot for free and must read a token before using each further slot,
+// writing it back when done.  Children find the pool through MAKEFLAGS:
+// "--jobserver-auth=R,W" names the pipe's inherited fds, and
+// "--jobserver-auth=fifo:PATH" a fifo.
+struct Jobserver {
+  Jobserver() : read_fd_(-1), write_fd_(-1), tokens_(0) {
+    pipe_[0] = pipe_[1] = -1;
+  }
+  ~Jobserver();
+
+  // Find the pool in |makeflags| and put its description in |auth|.
+  // Returns false if there isn't one.
+  static bool ParseMakeflags(const string& makeflags, string* auth);
+
+  // Join the pool described in |makeflags|.  Returns false, filling in
+  // |err| if the pool is advertised but unusable, if we can't join.
+  bool Connect(const string& makeflags, string* err);
+  // Create a pool of |jobs| slots and advertise it to child processes by
+  // adding it to MAKEFLAGS.
+  bool Create(int jobs, string* err);
+
+  // Take a token if one is available, without blocking.
+  bool Acquire();
+  // Return a token to the pool.
+  void Release();
+  // Return the tokens beyond those needed for |jobs| running jobs.
+  void ReleaseUnused(int jobs);
+
+  // Our own non-blocking descriptor for the read end, which is readable
+  // when a token may be available.
+  int read_fd_;
+  int write_fd_;
+  // Tokens we hold.
+  int tokens_;
+  // The pipe children inherit, if we created it.
+  int pipe_[2];
+};
+
+#endif  // NINJA_JOBSERVER_H_
@@ -0,0 +1,194 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "subprocess.h"
+
+namespace {
+
+// Restores MAKEFLAGS, which Create() changes, after each test.
+struct JobserverTest : public testing::Test {
+  virtual void SetUp() {
+    const char* makeflags = getenv("MAKEFLAGS");
+    had_makeflags_ = makeflags != NULL;
+    if (makeflags)
+      old_makeflags_ = makeflags;
+    unsetenv("MAKEFLAGS");
+  }
+  virtual void TearDown() {
+    if (had_makeflags_)
+      setenv("MAKEFLAGS", old_makeflags_.c_str(), 1);
+    else
+      unsetenv("MAKEFLAGS");
+  }
+
+  // Take every token there is.
+  int Drain(Jobserver* jobserver) {
+    int count = 0;
+    while (jobserver->Acquire())
+      ++count;
+    return count;
+  }
+
+  bool had_makeflags_;
+  string old_makeflags_;
+};
+
+}  // anonymous namespace
+
+TEST_F(JobserverTest, ParseMakeflags) {
+  string auth;
+  EXPECT_FALSE(Jobserver::ParseMakeflags("", &auth));
+  EXPECT_FALSE(Jobserver::ParseMakeflags("k -j4", &auth));
+  EXPECT_TRUE(Jobserver::ParseMakeflags(" -j4 --jobserver-auth=3,4", &auth));
+  EXPECT_EQ("3,4", auth);
+  EXPECT_TRUE(Jobserver::ParseMakeflags("--jobserver-fds=5,6 -j", &auth));
+  EXPECT_EQ("5,6", auth);
+  // The last one wins.
+  EXPECT_TRUE(Jobserver::ParseMakeflags(
+      "--jobserver-auth=3,4 --jobserver-fds=5,6 --jobserver-auth=7,8",
+      &auth));
+  EXPECT_EQ("7,8", auth);
+  EXPECT_TRUE(Jobserver::ParseMakeflags(
+      "-j4 --jobserver-auth=fifo:/tmp/GMfifo123", &auth));
+  EXPECT_EQ("fifo:/tmp/GMfifo123", auth);
+}
+
+TEST_F(JobserverTest, ConnectErrors) {
+  Jobserver jobserver;
+  string err;
+  EXPECT_FALSE(jobserver.Connect("-j4", &err));
+  EXPECT_EQ("", err);
+  // What make passes to commands it doesn't know run a sub-make.
+  EXPECT_FALSE(jobserver.Connect("--jobserver-auth=1000,1001", &err));
+  EXPECT_NE("", err);
+}
+
+TEST_F(JobserverTest, CreateAndConnect) {
+  Jobserver server;
+  string err;
+  ASSERT_TRUE(server.Create(4, &err)) << err;
+  const char* makeflags = getenv("MAKEFLAGS");
+  ASSERT_TRUE(makeflags != NULL);
+
+  // A client sees the same pool: 3 tokens beyond the implicit slot.
+  Jobserver client;
+  ASSERT_TRUE(client.Connect(makeflags, &err)) << err;
+  EXPECT_EQ(3, Drain(&client));
+  EXPECT_FALSE(server.Acquire());
+
+  // Running two jobs needs one token.
+  client.ReleaseUnused(2);
+  EXPECT_EQ(1, client.tokens_);
+  EXPECT_EQ(2, Drain(&server));
+}
+
+// A make-style child, in another process, holding tokens keeps ninja
+// from getting them until it gives them back.
+TEST_F(JobserverTest, ChildProcess) {
+  Jobserver server;
+  string err;
+  ASSERT_TRUE(server.Create(3, &err)) << err;
+
+  int to_child[2], from_child[2];
+  ASSERT_EQ(0, pipe(to_child));
+  ASSERT_EQ(0, pipe(from_child));
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    // Join through MAKEFLAGS, as a sub-make would, and take everything.
+    Jobserver child;
+    string child_err;
+    if (!child.Connect(getenv("MAKEFLAGS"), &child_err))
+      _exit(1);
+    char count = 0;
+    while (child.Acquire())
+      ++count;
+    if (write(from_child[1], &count, 1) != 1)
+      _exit(1);
+    // Hold the tokens until told to exit; the destructor returns them.
+    char go;
+    if (read(to_child[0], &go, 1) != 1)
+      _exit(1);
+    child.ReleaseUnused(0);
+    _exit(0);
+  }
+
+  char count = 0;
+  ASSERT_EQ(1, read(from_child[0], &count, 1));
+  EXPECT_EQ(2, count);
+  EXPECT_FALSE(server.Acquire());
+
+  char go = 1;
+  ASSERT_EQ(1, write(to_child[1], &go, 1));
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  EXPECT_EQ(2, Drain(&server));
+  server.ReleaseUnused(0);
+
+  close(to_child[0]);
+  close(to_child[1]);
+  close(from_child[0]);
+  close(from_child[1]);
+}
+
+// Commands started through Subprocess inherit the pool.
+TEST_F(JobserverTest, Subprocess) {
+  Jobserver server;
+  string err;
+  ASSERT_TRUE(server.Create(2, &err)) << err;
+
+  // Take a token using nothing but MAKEFLAGS and the shell, and print it.
+  Subprocess subproc;
+  ASSERT_TRUE(subproc.Start(
+      "r=${MAKEFLAGS##*--jobserver-auth=}; r=${r%%,*}; "
+      "dd bs=1 count=1 <&$r 2>/dev/null"));
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (!subproc.done())
+    subprocs.DoWork();
+  ASSERT_TRUE(subproc.Finish());
+  EXPECT_EQ("+", subproc.stdout_.buf_);
+  EXPECT_FALSE(server.Acquire());
+}
+
+TEST_F(JobserverTest, WakeOnToken) {
+  Jobserver server;
+  string err;
+  ASSERT_TRUE(server.Create(2, &err)) << err;
+  ASSERT_TRUE(server.Acquire());
+
+  // A command that gives the token back while it runs wakes up DoWork.
+  Subprocess subproc;
+  ASSERT_TRUE(subproc.Start(
+      "w=${MAKEFLAGS##*,}; printf + >&$w; sleep 0.2"));
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  server.tokens_ = 0;  // It's the command's now.
+  EXPECT_TRUE(subprocs.DoWork(server.read_fd_));
+  EXPECT_FALSE(subproc.done());
+  EXPECT_TRUE(server.Acquire());
+  while (!subproc.done())
+    subprocs.DoWork();
+  subproc.Finish();
+  subprocs.running_.clear();
+}
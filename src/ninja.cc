@@ -21,10 +21,18 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <map>
+
+#include "action_cache.h"
 #include "build.h"
 #include "build_log.h"
+#include "jobserver.h"
 #include "parsers.h"
+#include "trace.h"
+#include "util.h"
 
 #include "graphviz.h"
 
@@ -48,16 +56,31 @@ void usage(const BuildConfig& config) {
   fprintf(stderr,
 "usage: ninja [options] target\n"
 "\n"
+"a target of the form 'path^' builds what path is a direct input of.\n"
+"\n"
 "options:\n"
+"  -A DIR   skip commands whose outputs are in the action cache DIR, and\n"
+"           add the outputs of those that run\n"
+"  -Z MB    limit the action cache to MB megabytes [default=5120]\n"
+"  -d MODE  enable debugging (use -d list to list modes)\n"
 "  -f FILE  specify input build file [default=build.ninja]\n"
 "  -j N     run N jobs in parallel [default=%d]\n"
+"  -k N     keep going until N jobs fail (0 means no limit) [default=1]\n"
+"  -l N     do not start new jobs if the load average is greater than N\n"
+"  -p PCT   do not start new jobs while CPU or memory pressure exceeds PCT%%\n"
 "  -n       dry run (don't run commands but pretend they succeeded)\n"
+"  -R ADDR  run commands on the ninja_worker at ADDR (host:port) instead\n"
+"           of locally; repeat to use several workers\n"
 "  -v       show all command lines\n"
+"  -T FILE  write a timeline of the build to FILE, for chrome://tracing\n"
 "\n"
 "  -t TOOL  run a subtool.  tools are:\n"
 "             browse  browse dependency graph in a web browser\n"
+"             convertlog  rewrite the build log as text or binary\n"
 "             graph   output graphviz dot file for targets\n"
-"             query   show inputs/outputs for a path\n",
+"             query   show inputs/outputs for a path\n"
+"             rusage  list the commands using the most CPU, memory and I/O,\n"
+"                     per rule (optionally only for the rules given)\n",
           config.parallelism);
 }
 
@@ -86,6 +109,26 @@ int GuessParallelism() {
   }
 }
 
+// Enable the debugging mode |name|; returns false if there is no such
+// mode (or it was "list").
+bool DebugEnable(const string& name) {
+  if (name == "list") {
+    printf("debugging modes:\n"
+"  explain  explain what caused a command to execute\n"
+"  stats    print statistics about how commands were run\n");
+    return false;
+  } else if (name == "explain") {
+    g_explaining = true;
+    return true;
+  } else if (name == "stats") {
+    g_show_stats = true;
+    return true;
+  } else {
+    fprintf(stderr, "ninja: unknown debug setting '%s'\n", name.c_str());
+    return false;
+  }
+}
+
 struct RealFileReader : public ManifestParser::FileReader {
   bool ReadFile(const string& path, string* content, string* err) {
     return ::ReadFile(path, content, err) == 0;
@@ -129,6 +172,136 @@ int CmdQuery(State* state, int argc, char* argv[]) {
   return 0;
 }
 
+namespace {
+
+// Log entries for one rule, for CmdRusage.
+struct RuleUsage {
+  RuleUsage() : cpu_ms(0), max_rss_kb(0) {}
+  long long cpu_ms;
+  long max_rss_kb;
+  vector<BuildLog::LogEntry*> entries;
+};
+
+long long CpuMs(const BuildLog::LogEntry* entry) {
+  return (long long)entry->usage.user_ms + entry->usage.system_ms;
+}
+bool MoreCpu(const BuildLog::LogEntry* a, const BuildLog::LogEntry* b) {
+  return CpuMs(a) > CpuMs(b);
+}
+bool MoreRss(const BuildLog::LogEntry* a, const BuildLog::LogEntry* b) {
+  return a->usage.max_rss_kb > b->usage.max_rss_kb;
+}
+bool MoreIO(const BuildLog::LogEntry* a, const BuildLog::LogEntry* b) {
+  return a->usage.in_blocks + a->usage.out_blocks >
+      b->usage.in_blocks + b->usage.out_blocks;
+}
+bool MoreRuleCpu(const pair<string, RuleUsage>& a,
+                 const pair<string, RuleUsage>& b) {
+  return a.second.cpu_ms > b.second.cpu_ms;
+}
+
+}  // anonymous namespace
+
+int CmdRusage(State* state, const string& log_path, int argc, char* argv[]) {
+  const size_t kTopCount = 5;
+
+  BuildLog log;
+  string err;
+  if (!log.Load(log_path, &err)) {
+    fprintf(stderr, "error loading build log %s: %s\n",
+            log_path.c_str(), err.c_str());
+    return 1;
+  }
+  log.DecodeAll();
+
+  // Group entries by the rule that currently builds them.  An edge with
+  // several outputs logs the same usage for each; count it once.
+  map<string, RuleUsage> rules;
+  for (BuildLog::Log::iterator i = log.log_.begin(); i != log.log_.end();
+       ++i) {
+    BuildLog::LogEntry* entry = i->second;
+    Node* node = state->LookupNode(entry->output);
+    if (!node || !node->in_edge_ ||
+        node->in_edge_->outputs_[0] != node) {
+      continue;
+    }
+    if (CpuMs(entry) == 0 && entry->usage.max_rss_kb == 0)
+      continue;  // Logged before usage was recorded.
+    const string& rule_name = node->in_edge_->rule_->name_;
+    if (argc > 0 && find(argv, argv + argc, rule_name) == argv + argc)
+      continue;
+    RuleUsage* usage = &rules[rule_name];
+    usage->cpu_ms += CpuMs(entry);
+    usage->max_rss_kb = max(usage->max_rss_kb, entry->usage.max_rss_kb);
+    usage->entries.push_back(entry);
+  }
+  if (rules.empty()) {
+    printf("no resource usage recorded in %s; build to collect some\n",
+           log_path.c_str());
+    return 0;
+  }
+
+  vector<pair<string, RuleUsage> > sorted(rules.begin(), rules.end());
+  sort(sorted.begin(), sorted.end(), MoreRuleCpu);
+  for (vector<pair<string, RuleUsage> >::iterator i = sorted.begin();
+       i != sorted.end(); ++i) {
+    RuleUsage* usage = &i->second;
+    vector<BuildLog::LogEntry*>& entries = usage->entries;
+    size_t top = min(kTopCount, entries.size());
+    printf("%s: %d commands, %.1fs CPU, peak RSS %.1fMB\n",
+           i->first.c_str(), (int)entries.size(), usage->cpu_ms / 1000.0,
+           usage->max_rss_kb / 1024.0);
+
+    partial_sort(entries.begin(), entries.begin() + top, entries.end(),
+                 MoreRss);
+    printf("  by peak RSS:\n");
+    for (size_t j = 0; j < top; ++j) {
+      printf("    %9.1fMB  %s\n", entries[j]->usage.max_rss_kb / 1024.0,
+             entries[j]->output.c_str());
+    }
+
+    partial_sort(entries.begin(), entries.begin() + top, entries.end(),
+                 MoreCpu);
+    printf("  by CPU (user+sys):\n");
+    for (size_t j = 0; j < top; ++j) {
+      printf("    %6.1fs+%5.1fs  %s\n", entries[j]->usage.user_ms / 1000.0,
+             entries[j]->usage.system_ms / 1000.0,
+             entries[j]->output.c_str());
+    }
+
+    partial_sort(entries.begin(), entries.begin() + top, entries.end(),
+                 MoreIO);
+    printf("  by block I/O (in/out):\n");
+    for (size_t j = 0; j < top; ++j) {
+      printf("    %6ld/%-6ld  %s\n", entries[j]->usage.in_blocks,
+             entries[j]->usage.out_blocks, entries[j]->output.c_str());
+    }
+  }
+  return 0;
+}
+
+int CmdConvertLog(const string& log_path, int argc, char* argv[]) {
+  if (argc != 1 || (strcmp(argv[0], "text") && strcmp(argv[0], "binary"))) {
+    fprintf(stderr, "usage: ninja -t convertlog text|binary\n");
+    return 1;
+  }
+
+  BuildLog log;
+  string err;
+  if (!log.Load(log_path, &err)) {
+    fprintf(stderr, "error loading build log %s: %s\n",
+            log_path.c_str(), err.c_str());
+    return 1;
+  }
+  log.binary_ = strcmp(argv[0], "binary") == 0;
+  if (!log.Recompact(log_path, &err)) {
+    fprintf(stderr, "error writing build log %s: %s\n",
+            log_path.c_str(), err.c_str());
+    return 1;
+  }
+  return 0;
+}
+
 int CmdBrowse(State* state, int argc, char* argv[]) {
   // Create a temporary file, dump the Python code into it, and
   // delete the file, keeping our open handle to it.
@@ -157,34 +330,73 @@ int main(int argc, char** argv) {
   BuildConfig config;
   const char* input_file = "build.ninja";
   string tool;
+  const char* trace_file = NULL;
+  vector<string> workers;
+  const char* cache_dir = NULL;
+  bool parallelism_given = false;
+  long long cache_size_mb = 5120;
 
   config.parallelism = GuessParallelism();
+  if (const char* rate = getenv("NINJA_STATUS_RATE"))
+    config.status_rate = atoi(rate);
+  if (const char* stall = getenv("NINJA_STALL_REPORT"))
+    config.stall_report_ms = atoi(stall) * 1000;
 
   int opt;
-  while ((opt = getopt_long(argc, argv, "f:hj:nt:v", options, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "A:d:f:hj:k:l:np:R:t:T:vZ:",
+                            options, NULL)) != -1) {
     switch (opt) {
+      case 'A':
+        cache_dir = optarg;
+        break;
+      case 'd':
+        if (!DebugEnable(optarg))
+          return 1;
+        break;
       case 'f':
         input_file = optarg;
         break;
       case 'j':
         config.parallelism = atoi(optarg);
+        parallelism_given = true;
+        break;
+      case 'k': {
+        // Treat 0 (and garbage) as "never stop for failures".
+        int failures = atoi(optarg);
+        config.failures_allowed = failures > 0 ? failures : INT_MAX;
+        break;
+      }
+      case 'l':
+        config.max_load_average = atof(optarg);
         break;
       case 'n':
         config.dry_run = true;
         break;
+      case 'p':
+        config.max_pressure = atof(optarg);
+        break;
+      case 'R':
+        workers.push_back(optarg);
+        break;
       case 'v':
         config.verbosity = BuildConfig::VERBOSE;
         break;
       case 't':
         tool = optarg;
         break;
+      case 'T':
+        trace_file = optarg;
+        break;
+      case 'Z':
+        cache_size_mb = atoll(optarg);
+        break;
       case 'h':
       default:
         usage(config);
         return 1;
     }
   }
-  if (optind >= argc) {
+  if (optind >= argc && tool != "rusage") {
     fprintf(stderr, "expected target to build\n");
     usage(config);
     return 1;
@@ -192,21 +404,42 @@ int main(int argc, char** argv) {
   argv += optind;
   argc -= optind;
 
+  // Each running command holds a pipe and a pidfd open; leave some room
+  // for everything else.
+  int max_jobs = (RaiseOpenFileLimit() - 64) / 2;
+  if (max_jobs > 0 && config.parallelism > max_jobs) {
+    fprintf(stderr, "ninja: warning: too few open files allowed for -j %d; "
+            "running %d jobs at a time\n", config.parallelism, max_jobs);
+    config.parallelism = max_jobs;
+  }
+
   char cwd[PATH_MAX];
   if (!getcwd(cwd, sizeof(cwd))) {
     perror("getcwd");
     return 1;
   }
 
+  Trace trace;
+  Trace* tracer = trace_file ? &trace : NULL;
+
   State state;
   RealFileReader file_reader;
   ManifestParser parser(&state, &file_reader);
   string err;
-  if (!parser.Load(input_file, &err)) {
-    fprintf(stderr, "error loading '%s': %s\n", input_file, err.c_str());
-    return 1;
+  {
+    ScopedTracePhase phase(tracer, "manifest parse");
+    if (!parser.Load(input_file, &err)) {
+      fprintf(stderr, "error loading '%s': %s\n", input_file, err.c_str());
+      return 1;
+    }
   }
 
+  const string build_dir = state.bindings_.LookupVariable("builddir");
+  const char* kLogPath = ".ninja_log";
+  string log_path = kLogPath;
+  if (!build_dir.empty())
+    log_path = build_dir + "/" + kLogPath;
+
   if (!tool.empty()) {
     if (tool == "graph")
       return CmdGraph(&state, argc, argv);
@@ -214,6 +447,10 @@ int main(int argc, char** argv) {
       return CmdQuery(&state, argc, argv);
     if (tool == "browse")
       return CmdBrowse(&state, argc, argv);
+    if (tool == "rusage")
+      return CmdRusage(&state, log_path, argc, argv);
+    if (tool == "convertlog")
+      return CmdConvertLog(log_path, argc, argv);
     fprintf(stderr, "unknown tool '%s'\n", tool.c_str());
   }
 
@@ -221,22 +458,21 @@ int main(int argc, char** argv) {
   build_log.SetConfig(&config);
   state.build_log_ = &build_log;
 
-  const string build_dir = state.bindings_.LookupVariable("builddir");
-  const char* kLogPath = ".ninja_log";
-  string log_path = kLogPath;
   if (!build_dir.empty()) {
     if (mkdir(build_dir.c_str(), 0777) < 0 && errno != EEXIST) {
       fprintf(stderr, "Error creating build directory %s: %s\n",
               build_dir.c_str(), strerror(errno));
       return 1;
     }
-    log_path = build_dir + "/" + kLogPath;
   }
 
-  if (!build_log.Load(log_path.c_str(), &err)) {
-    fprintf(stderr, "error loading build log %s: %s\n",
-            log_path.c_str(), err.c_str());
-    return 1;
+  {
+    ScopedTracePhase phase(tracer, "log load");
+    if (!build_log.Load(log_path.c_str(), &err)) {
+      fprintf(stderr, "error loading build log %s: %s\n",
+              log_path.c_str(), err.c_str());
+      return 1;
+    }
   }
 
   if (!build_log.OpenForWrite(log_path.c_str(), &err)) {
@@ -244,7 +480,51 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  // Share job slots with the make (or ninja) that ran us, unless told
+  // how many to use.  Otherwise, if asked to, offer ours to the makes and
+  // ninjas we run; that changes the MAKEFLAGS every command sees, so it
+  // isn't the default.
+  Jobserver jobserver;
+  if (!config.dry_run && workers.empty()) {
+    const char* makeflags = getenv("MAKEFLAGS");
+    const char* serve = getenv("NINJA_JOBSERVER");
+    string jobserver_err;
+    if (!parallelism_given && makeflags &&
+        jobserver.Connect(makeflags, &jobserver_err)) {
+      config.jobserver = &jobserver;
+      // make's tokens decide how many commands run, not our guess; only
+      // the open file limit still applies.
+      config.max_jobs = max_jobs > 0 ? max_jobs : INT_MAX;
+    } else {
+      if (!jobserver_err.empty())
+        fprintf(stderr, "ninja: warning: %s\n", jobserver_err.c_str());
+      jobserver_err.clear();
+      if (serve && *serve && strcmp(serve, "0") != 0 &&
+          config.parallelism > 1) {
+        if (jobserver.Create(config.parallelism, &jobserver_err))
+          config.jobserver = &jobserver;
+        else
+          fprintf(stderr, "ninja: warning: %s\n", jobserver_err.c_str());
+      }
+    }
+  }
+
   Builder builder(&state, config);
+  builder.SetTrace(tracer);
+  if (!workers.empty() && !config.dry_run) {
+    if (!builder.UseWorkers(workers, &err)) {
+      fprintf(stderr, "ninja: %s\n", err.c_str());
+      return 1;
+    }
+  }
+  ActionCache action_cache;
+  if (cache_dir && !config.dry_run) {
+    if (!action_cache.Open(cache_dir, cache_size_mb << 20, &err)) {
+      fprintf(stderr, "ninja: %s\n", err.c_str());
+      return 1;
+    }
+    builder.action_cache_ = &action_cache;
+  }
   for (int i = 0; i < argc; ++i) {
     if (!builder.AddTarget(argv[i], &err)) {
       if (!err.empty()) {
@@ -257,10 +537,26 @@ int main(int argc, char** argv) {
     }
   }
 
-  bool success = builder.Build(&err);
+  bool success;
+  {
+    ScopedTracePhase phase(tracer, "build");
+    success = builder.Build(&err);
+  }
+  builder.PrintSummary();
   if (!err.empty()) {
     printf("build stopped: %s.\n", err.c_str());
   }
+  if (builder.action_cache_ && action_cache.stores_ > 0)
+    action_cache.Trim();
+
+  if (trace_file) {
+    string trace_err;
+    if (!trace.Write(trace_file, &trace_err)) {
+      fprintf(stderr, "error writing trace %s: %s\n", trace_file,
+              trace_err.c_str());
+      return 1;
+    }
+  }
 
   return success ? 0 : 1;
 }
@@ -31,6 +31,7 @@ using namespace std;
 struct Edge;
 struct FileStat;
 struct Node;
+struct Pool;
 struct Rule;
 
 int ReadFile(const string& path, string* contents, string* err);
@@ -38,7 +39,8 @@ int ReadFile(const string& path, string* contents, string* err);
 struct DiskInterface {
   // stat() a file, returning the mtime, or 0 if missing and -1 on other errors.
   virtual int Stat(const string& path) = 0;
-  // Create a directory, returning false on failure.
+  // Create a directory, returning false on failure.  A directory that
+  // already exists, e.g. one something else just made, is no failure.
   virtual bool MakeDir(const string& path) = 0;
   // Read a file to a string.  Fill in |err| on error.
   virtual string ReadFile(const string& path, string* err) = 0;
@@ -57,6 +59,9 @@ struct StatCache {
   typedef hash_map<string, FileStat*> Paths;
   Paths paths_;
   FileStat* GetFile(const string& path);
+  // Like DiskInterface::MakeDirs, but remembers which directories exist
+  // so that each one is stat()ed or created at most once per build.
+  bool MakeDirs(DiskInterface* disk_interface, const string& path);
   void Dump();
   void Reload();
 };
@@ -68,6 +73,8 @@ struct State {
 
   void AddRule(const Rule* rule);
   const Rule* LookupRule(const string& rule_name);
+  void AddPool(Pool* pool);
+  Pool* LookupPool(const string& pool_name);
   Edge* AddEdge(const Rule* rule);
   Node* GetNode(const string& path);
   Node* LookupNode(const string& path);
@@ -76,6 +83,7 @@ struct State {
 
   StatCache stat_cache_;
   map<string, const Rule*> rules_;
+  map<string, Pool*> pools_;
   vector<Edge*> edges_;
   BindingEnv bindings_;
   struct BuildLog* build_log_;
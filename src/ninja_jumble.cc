@@ -100,6 +100,12 @@ string RealDiskInterface::ReadFile(const string& path, string* err) {
 
 bool RealDiskInterface::MakeDir(const string& path) {
   if (mkdir(path.c_str(), 0777) < 0) {
+    int mkdir_errno = errno;
+    struct stat st;
+    if (mkdir_errno == EEXIST && stat(path.c_str(), &st) == 0 &&
+        S_ISDIR(st.st_mode))
+      return true;
+    errno = mkdir_errno;
     fprintf(stderr, "mkdir(%s): %s\n", path.c_str(), strerror(errno));
     return false;
   }
@@ -115,6 +121,27 @@ FileStat* StatCache::GetFile(const string& path) {
   return file;
 }
 
+bool StatCache::MakeDirs(DiskInterface* disk_interface, const string& path) {
+  string dir = DirName(path);
+  if (dir.empty())
+    return true;  // Reached root; assume it's there.
+  FileStat* file = GetFile(dir);
+  file->StatIfNecessary(disk_interface);
+  if (file->mtime_ < 0)
+    return false;  // Error.
+  if (file->exists())
+    return true;  // Exists already; we're done.
+
+  // Directory doesn't exist.  Try creating its parent first.
+  if (!MakeDirs(disk_interface, dir))
+    return false;
+  if (!disk_interface->MakeDir(dir))
+    return false;
+  // We just created it, so it's about as new as a file can be.
+  file->mtime_ = time(NULL);
+  return true;
+}
+
 #include <stdio.h>
 
 void StatCache::Dump() {
@@ -146,10 +173,23 @@ void State::AddRule(const Rule* rule) {
   rules_[rule->name_] = rule;
 }
 
+Pool* State::LookupPool(const string& pool_name) {
+  map<string, Pool*>::iterator i = pools_.find(pool_name);
+  if (i == pools_.end())
+    return NULL;
+  return i->second;
+}
+
+void State::AddPool(Pool* pool) {
+  assert(LookupPool(pool->name_) == NULL);
+  pools_[pool->name_] = pool;
+}
+
 Edge* State::AddEdge(const Rule* rule) {
   Edge* edge = new Edge();
   edge->rule_ = rule;
   edge->env_ = &bindings_;
+  edge->id_ = edges_.size();
   edges_.push_back(edge);
   return edge;
 }
@@ -14,6 +14,7 @@
 
 #include "ninja.h"
 
+#include <errno.h>
 #include <gtest/gtest.h>
 
 #include "build.h"
@@ -242,3 +243,16 @@ TEST_F(DiskInterfaceTest, ReadFile) {
 TEST_F(DiskInterfaceTest, MakeDirs) {
   EXPECT_TRUE(disk_.MakeDirs("path/with/double//slash/"));
 }
+
+TEST_F(DiskInterfaceTest, MakeDirExisting) {
+  EXPECT_TRUE(disk_.MakeDir("dir"));
+  EXPECT_TRUE(disk_.MakeDir("dir"));
+  ASSERT_EQ(0, system("touch file"));
+  EXPECT_FALSE(disk_.MakeDir("file"));
+  EXPECT_EQ(EEXIST, errno);
+}
+
+TEST_F(DiskInterfaceTest, MakeDirKeepsErrno) {
+  EXPECT_FALSE(disk_.MakeDir("nonexistent/dir"));
+  EXPECT_EQ(ENOENT, errno);
+}
@@ -0,0 +1,102 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ninja_worker runs commands sent by "ninja -R host:port".  See remote.h
+// for the protocol.
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "remote.h"
+#include "util.h"
+
+namespace {
+
+void usage() {
+  fprintf(stderr,
+"usage: ninja_worker [options] [[host]:port]\n"
+"\n"
+"Runs the commands ninja sends it.  It runs *any* command it is sent, so\n"
+"only listen on addresses you trust.  The default is 127.0.0.1:8315; a\n"
+"bare :port listens on every interface.\n"
+"\n"
+"options:\n"
+"  -C DIR   change to DIR before doing anything else\n"
+"  -j N     run N commands in parallel [default=number of CPUs]\n");
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  int capacity = sysconf(_SC_NPROCESSORS_ONLN);
+  if (capacity < 1)
+    capacity = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "C:hj:")) != -1) {
+    switch (opt) {
+      case 'C':
+        if (chdir(optarg) < 0) {
+          fprintf(stderr, "ninja_worker: chdir %s: %s\n", optarg,
+                  strerror(errno));
+          return 1;
+        }
+        break;
+      case 'j':
+        capacity = atoi(optarg);
+        if (capacity < 1) {
+          usage();
+          return 1;
+        }
+        break;
+      case 'h':
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  // Each running command holds a pipe and a pidfd open.
+  int max_jobs = (RaiseOpenFileLimit() - 64) / 2;
+  if (max_jobs > 0 && capacity > max_jobs) {
+    fprintf(stderr, "ninja_worker: too few open files allowed for -j %d; "
+            "running %d\n", capacity, max_jobs);
+    capacity = max_jobs;
+  }
+
+  string address = "127.0.0.1:8315";
+  if (optind < argc)
+    address = argv[optind];
+
+  // A client hanging up mid-reply shouldn't take the worker down.  The
+  // commands we run still get the default (see Subprocess::Start()).
+  signal(SIGPIPE, SIG_IGN);
+
+  WorkerServer server(capacity);
+  string err;
+  if (!server.Listen(address, &err)) {
+    fprintf(stderr, "ninja_worker: %s\n", err.c_str());
+    return 1;
+  }
+  printf("ninja_worker: running %d commands at a time on port %d\n",
+         capacity, server.port());
+  fflush(stdout);
+  server.Serve();
+  return 0;
+}
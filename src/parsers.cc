@@ -17,7 +17,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "graph.h"
 #include "ninja.h"
@@ -30,6 +32,7 @@ string Token::AsString() const {
   case BUILD:    return "'build'";
   case SUBNINJA: return "'subninja'";
   case INCLUDE:  return "'include'";
+  case POOL:     return "'pool'";
   case NEWLINE:  return "newline";
   case EQUALS:   return "'='";
   case COLON:    return "':'";
@@ -115,7 +118,9 @@ bool Tokenizer::ExpectToken(Token::Type expected, string* err) {
 
 bool Tokenizer::ReadIdent(string* out) {
   PeekToken();
-  if (token_.type_ != Token::IDENT)
+  // "pool" is only a keyword at the start of a statement; it's still fine
+  // as a variable or file name.
+  if (token_.type_ != Token::IDENT && token_.type_ != Token::POOL)
     return false;
   out->assign(token_.pos_, token_.end_ - token_.pos_);
   ConsumeToken();
@@ -189,6 +194,8 @@ Token::Type Tokenizer::PeekToken() {
       token_.type_ = Token::INCLUDE;
     else if (len == 8 && memcmp(token_.pos_, "subninja", 8) == 0)
       token_.type_ = Token::SUBNINJA;
+    else if (len == 4 && memcmp(token_.pos_, "pool", 4) == 0)
+      token_.type_ = FollowedByEquals() ? Token::IDENT : Token::POOL;
     else
       token_.type_ = Token::IDENT;
   } else if (*cur_ == ':') {
@@ -223,6 +230,13 @@ Token::Type Tokenizer::PeekToken() {
   return token_.type_;
 }
 
+bool Tokenizer::FollowedByEquals() const {
+  const char* next = cur_;
+  while (next < end_ && *next == ' ')
+    ++next;
+  return next < end_ && *next == '=';
+}
+
 void Tokenizer::ConsumeToken() {
   token_.Clear();
 }
@@ -273,6 +287,10 @@ bool ManifestParser::Parse(const string& input, string* err) {
         if (!ParseRule(err))
           return false;
         break;
+      case Token::POOL:
+        if (!ParsePool(err))
+          return false;
+        break;
       case Token::BUILD:
         if (!ParseEdge(err))
           return false;
@@ -343,6 +361,13 @@ bool ManifestParser::ParseRule(string* err) {
       } else if (key == "description") {
         if (!rule->description_.Parse(val, &parse_err))
           return tokenizer_.Error(parse_err, err);
+      } else if (key == "pool") {
+        if (!rule->pool_.Parse(val, &parse_err))
+          return tokenizer_.Error(parse_err, err);
+      } else if (key == "timeout") {
+        rule->timeout_ = atoi(val.c_str());
+        if (rule->timeout_ <= 0)
+          return tokenizer_.Error("invalid timeout '" + val + "'", err);
       } else {
         // Die on other keyvals for now; revisit if we want to add a
         // scope here.
@@ -359,6 +384,45 @@ bool ManifestParser::ParseRule(string* err) {
   return true;
 }
 
+bool ManifestParser::ParsePool(string* err) {
+  if (!tokenizer_.ExpectToken(Token::POOL, err))
+    return false;
+  string name;
+  if (!tokenizer_.ReadIdent(&name))
+    return tokenizer_.ErrorExpected("pool name", err);
+  if (state_->LookupPool(name) != NULL)
+    return tokenizer_.Error("duplicate pool '" + name + "'", err);
+  if (!tokenizer_.Newline(err))
+    return false;
+
+  int depth = -1;
+  if (tokenizer_.PeekToken() == Token::INDENT) {
+    tokenizer_.ConsumeToken();
+
+    while (tokenizer_.PeekToken() != Token::OUTDENT) {
+      string key, val;
+      if (!ParseLet(&key, &val, true, err))
+        return false;
+
+      if (key == "depth") {
+        char* end;
+        depth = strtol(val.c_str(), &end, 10);
+        if (val.empty() || *end || depth <= 0)
+          return tokenizer_.Error("invalid pool depth '" + val + "'", err);
+      } else {
+        return tokenizer_.Error("unexpected variable '" + key + "'", err);
+      }
+    }
+    tokenizer_.ConsumeToken();
+  }
+
+  if (depth < 0)
+    return tokenizer_.Error("expected 'depth =' line", err);
+
+  state_->AddPool(new Pool(name, depth));
+  return true;
+}
+
 bool ManifestParser::ParseLet(string* name, string* value, bool expand,
                               string* err) {
   if (!tokenizer_.ReadIdent(name))
@@ -468,6 +532,10 @@ bool ManifestParser::ParseEdge(string* err) {
   // Default to using outer env.
   BindingEnv* env = env_;
 
+  // The edge's own "pool" binding, if any, overrides the rule's.
+  string pool_name;
+  bool pool_bound = false;
+
   // But use a nested env if there are variables in scope.
   if (tokenizer_.PeekToken() == Token::INDENT) {
     tokenizer_.ConsumeToken();
@@ -479,11 +547,24 @@ bool ManifestParser::ParseEdge(string* err) {
       string key, val;
       if (!ParseLet(&key, &val, true, err))
         return false;
+      if (key == "pool") {
+        pool_name = val;
+        pool_bound = true;
+      }
       env->AddBinding(key, val);
     }
     tokenizer_.ConsumeToken();
   }
 
+  if (!pool_bound)
+    pool_name = rule->pool_.Evaluate(env);
+  Pool* pool = NULL;
+  if (!pool_name.empty()) {
+    pool = state_->LookupPool(pool_name);
+    if (!pool)
+      return tokenizer_.Error("unknown pool name '" + pool_name + "'", err);
+  }
+
   // Evaluate all variables in paths.
   // XXX: fast path skip the eval parse if there's no $ in the path?
   vector<string>* paths[2] = { &ins, &outs };
@@ -500,6 +581,7 @@ bool ManifestParser::ParseEdge(string* err) {
 
   Edge* edge = state_->AddEdge(rule);
   edge->env_ = env;
+  edge->pool_ = pool;
   for (vector<string>::iterator i = ins.begin(); i != ins.end(); ++i)
     state_->AddIn(edge, *i);
   for (vector<string>::iterator i = outs.begin(); i != outs.end(); ++i)
@@ -31,6 +31,7 @@ struct Token {
     BUILD,
     SUBNINJA,
     INCLUDE,
+    POOL,
     NEWLINE,
     EQUALS,
     COLON,
@@ -71,6 +72,8 @@ struct Tokenizer {
 
   Token::Type PeekToken();
   void ConsumeToken();
+  // Whether the next token is "=", which makes a keyword a variable name.
+  bool FollowedByEquals() const;
 
   bool whitespace_significant_;
 
@@ -105,6 +108,7 @@ struct ManifestParser {
   bool Parse(const string& input, string* err);
 
   bool ParseRule(string* err);
+  bool ParsePool(string* err);
   // Parse a key=val statement.  If expand is true, evaluate variables
   // within the value immediately.
   bool ParseLet(string* key, string* val, bool expand, string* err);
@@ -62,6 +62,66 @@ TEST_F(ParserTest, Rules) {
   const Rule* rule = state.rules_.begin()->second;
   EXPECT_EQ("cat", rule->name_);
   EXPECT_EQ("cat $in > $out", rule->command_.unparsed());
+  EXPECT_EQ(0, rule->timeout_);
+}
+
+TEST_F(ParserTest, Timeout) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"rule test\n"
+"  command = run-tests\n"
+"  timeout = 600\n"
+"\n"
+"build results: test\n"));
+
+  EXPECT_EQ(600, state.LookupRule("test")->timeout_);
+}
+
+TEST_F(ParserTest, Pools) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"pool link_pool\n"
+"  depth = 4\n"
+"pool heavy\n"
+"  depth = 1\n"
+"\n"
+"rule link\n"
+"  command = ld -o $out $in\n"
+"  pool = link_pool\n"
+"rule cc\n"
+"  command = cc -c $in\n"
+"  pool = $cc_pool\n"
+"build a: link a.o\n"
+"build b: link b.o\n"
+"  pool = heavy\n"
+"build a.o: cc a.c\n"
+"build b.o: cc b.c\n"
+"  cc_pool = heavy\n"
+"build pool: cc pool.c\n"));
+
+  ASSERT_EQ(2, state.pools_.size());
+  Pool* link_pool = state.LookupPool("link_pool");
+  ASSERT_TRUE(link_pool);
+  EXPECT_EQ(4, link_pool->depth_);
+  EXPECT_EQ(link_pool, state.GetNode("a")->in_edge_->pool_);
+  EXPECT_EQ(state.LookupPool("heavy"), state.GetNode("b")->in_edge_->pool_);
+  EXPECT_EQ(NULL, state.GetNode("a.o")->in_edge_->pool_);
+  // A rule's pool is evaluated in the edge's scope.
+  EXPECT_EQ(state.LookupPool("heavy"), state.GetNode("b.o")->in_edge_->pool_);
+  // "pool" is still usable as a path.
+  EXPECT_TRUE(state.LookupNode("pool"));
+}
+
+TEST_F(ParserTest, PoolVariable) {
+  // Manifests from before pools may have a variable named "pool".
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"pool = x\n"
+"pool=y\n"
+"rule cat\n"
+"  command = cat $in > $out $pool\n"
+"build out: cat in\n"));
+
+  EXPECT_EQ("y", state.bindings_.LookupVariable("pool"));
+  EXPECT_EQ("cat in > out y",
+            state.GetNode("out")->in_edge_->EvaluateCommand());
 }
 
 TEST_F(ParserTest, Variables) {
@@ -265,6 +325,49 @@ TEST_F(ParserTest, Errors) {
                               &err));
     EXPECT_EQ("line 4, col 1: expected variable after $", err);
   }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("pool foo\n  depth = x\n", &err));
+    EXPECT_EQ("line 3, col 0: invalid pool depth 'x'", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("pool foo\n", &err));
+    EXPECT_EQ("line 2, col 1: expected 'depth =' line", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("rule cc\n  command = foo\n  pool = bar\n"
+                              "build a.o: cc a.c\n",
+                              &err));
+    EXPECT_EQ("line 5, col 1: unknown pool name 'bar'", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("pool foo\n  depth = 1\npool foo\n", &err));
+    EXPECT_EQ("line 3, col 6: duplicate pool 'foo'", err);
+  }
+
+  {
+    State state;
+    ManifestParser parser(&state, NULL);
+    string err;
+    EXPECT_FALSE(parser.Parse("rule cc\n  command = foo\n  timeout = 0\n",
+                              &err));
+    EXPECT_EQ("line 4, col 0: invalid timeout '0'", err);
+  }
 }
 
 TEST_F(ParserTest, SubNinja) {
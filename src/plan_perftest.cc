@@ -0,0 +1,314 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures Plan construction and scheduling on synthetic graphs, and
+// simulates how long a build takes with and without critical-path
+// ordering.
+// Usage: plan_perftest [width [depth]]
+//        plan_perftest replay MANIFEST LOG TARGET [parallelism]
+// The replay form rebuilds TARGET from scratch in simulation, taking each
+// edge's duration from LOG.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "build.h"
+#include "build_log.h"
+#include "graph.h"
+#include "ninja.h"
+#include "parsers.h"
+
+namespace {
+
+double Now() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+Rule* AddCatRule(State* state) {
+  Rule* rule = new Rule("cat");
+  string err;
+  rule->ParseCommand("cat $in > $out", &err);
+  state->AddRule(rule);
+  return rule;
+}
+
+// One generated header used by |width| objects, all linked together:
+//   gen -> header.h -> obj/N.o (x width) -> out
+Node* BuildWideGraph(State* state, int width) {
+  Rule* rule = AddCatRule(state);
+  Edge* gen = state->AddEdge(rule);
+  state->AddIn(gen, "header.in");
+  state->AddOut(gen, "header.h");
+
+  Edge* link = state->AddEdge(rule);
+  char buf[64];
+  for (int i = 0; i < width; ++i) {
+    Edge* edge = state->AddEdge(rule);
+    sprintf(buf, "src/%d.c", i);
+    state->AddIn(edge, buf);
+    state->AddIn(edge, "header.h");
+    sprintf(buf, "obj/%d.o", i);
+    state->AddOut(edge, buf);
+    state->AddIn(link, buf);
+  }
+  state->AddOut(link, "out");
+  return state->GetNode("out");
+}
+
+// A single chain |depth| edges long: in -> n1 -> n2 -> ... -> out.
+Node* BuildChain(State* state, int depth) {
+  Rule* rule = AddCatRule(state);
+  char in[64], out[64];
+  strcpy(in, "in");
+  for (int i = 0; i < depth; ++i) {
+    Edge* edge = state->AddEdge(rule);
+    state->AddIn(edge, in);
+    sprintf(out, "n%d", i);
+    state->AddOut(edge, out);
+    strcpy(in, out);
+  }
+  return state->GetNode(in);
+}
+
+// Mark every generated node dirty, as if building from scratch.
+void DirtyAll(State* state) {
+  for (vector<Edge*>::iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    for (vector<Node*>::iterator i = (*e)->outputs_.begin();
+         i != (*e)->outputs_.end(); ++i) {
+      (*i)->dirty_ = true;
+    }
+  }
+}
+
+// Drive |plan| to completion as if every command finished instantly.
+int RunPlan(Plan* plan) {
+  int edges = 0;
+  while (Edge* edge = plan->FindWork()) {
+    for (vector<Node*>::iterator i = edge->outputs_.begin();
+         i != edge->outputs_.end(); ++i) {
+      (*i)->dirty_ = false;
+    }
+    plan->EdgeFinished(edge);
+    ++edges;
+  }
+  return edges;
+}
+
+// A build where most of the work is short and parallel, plus one long
+// serial chain that sorts last in the manifest:
+//   src/N.c -> obj/N.o (x count, 1s each)
+//   gen.in -> gen.h -> big.o -> big (5s, 20s, 10s)
+Node* BuildChainGraph(State* state, BuildLog* log, int count) {
+  Rule* rule = AddCatRule(state);
+  Edge* all = state->AddEdge(&State::kPhonyRule);
+  char buf[64];
+  for (int i = 0; i < count; ++i) {
+    Edge* edge = state->AddEdge(rule);
+    sprintf(buf, "src/%d.c", i);
+    state->AddIn(edge, buf);
+    sprintf(buf, "obj/%d.o", i);
+    state->AddOut(edge, buf);
+    state->AddIn(all, buf);
+  }
+  const char* chain[] = { "gen.in", "gen.h", "big.o", "big" };
+  const int times[] = { 5000, 20000, 10000 };
+  for (int i = 0; i < 3; ++i) {
+    Edge* edge = state->AddEdge(rule);
+    state->AddIn(edge, chain[i]);
+    state->AddOut(edge, chain[i + 1]);
+  }
+  state->AddIn(all, "big");
+  state->AddOut(all, "all");
+
+  for (vector<Edge*>::iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    if ((*e)->is_phony())
+      continue;
+    BuildLog::LogEntry* entry = new BuildLog::LogEntry;
+    entry->output = (*e)->outputs_[0]->file_->path_;
+    entry->command = (*e)->EvaluateCommand();
+    entry->time_ms = 1000;
+    for (int i = 0; i < 3; ++i) {
+      if (entry->output == chain[i + 1])
+        entry->time_ms = times[i];
+    }
+    log->log_[entry->output] = entry;
+  }
+  return state->GetNode("all");
+}
+
+// Simulate running |plan| with |parallelism| slots, each edge taking the
+// time logged for its first output (or 0 if there is none).  Returns the
+// simulated wall-clock time in ms.
+long long Simulate(Plan* plan, BuildLog* log, int parallelism) {
+  // Running edges and their finish times.
+  vector<pair<long long, Edge*> > running;
+  long long now = 0;
+  for (;;) {
+    while ((int)running.size() < parallelism) {
+      Edge* edge = plan->FindWork();
+      if (!edge)
+        break;
+      int duration = 0;
+      BuildLog::LogEntry* entry = NULL;
+      if (!edge->is_phony())
+        entry = log->LookupByOutput(edge->outputs_[0]->file_->path_);
+      if (entry)
+        duration = entry->time_ms;
+      running.push_back(make_pair(now + duration, edge));
+    }
+    if (running.empty())
+      break;
+
+    vector<pair<long long, Edge*> >::iterator first =
+        min_element(running.begin(), running.end());
+    now = first->first;
+    Edge* edge = first->second;
+    running.erase(first);
+    for (vector<Node*>::iterator i = edge->outputs_.begin();
+         i != edge->outputs_.end(); ++i) {
+      (*i)->dirty_ = false;
+    }
+    plan->EdgeFinished(edge);
+  }
+  return now;
+}
+
+// Simulate a from-scratch build of |target|, first in manifest order and
+// then in critical-path order.
+void CompareSchedules(State* state, BuildLog* log, Node* target,
+                      int parallelism) {
+  long long results[2];
+  for (int weighted = 0; weighted < 2; ++weighted) {
+    DirtyAll(state);
+    Plan plan;
+    string err;
+    if (!plan.AddTarget(target, &err) && !err.empty()) {
+      fprintf(stderr, "AddTarget: %s\n", err.c_str());
+      exit(1);
+    }
+    if (weighted)
+      plan.ComputeCriticalPath(log);
+    results[weighted] = Simulate(&plan, log, parallelism);
+  }
+  printf("simulated build at -j%d: manifest order %.1fs, "
+         "critical path %.1fs (%.1f%% faster)\n", parallelism,
+         results[0] / 1000.0, results[1] / 1000.0,
+         100.0 * (results[0] - results[1]) / results[0]);
+}
+
+struct RealFileReader : public ManifestParser::FileReader {
+  bool ReadFile(const string& path, string* content, string* err) {
+    return ::ReadFile(path, content, err) == 0;
+  }
+};
+
+int Replay(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: plan_perftest replay MANIFEST LOG TARGET "
+            "[parallelism]\n");
+    return 1;
+  }
+  int parallelism = argc > 3 ? atoi(argv[3]) : 64;
+
+  State state;
+  RealFileReader file_reader;
+  ManifestParser parser(&state, &file_reader);
+  string err;
+  if (!parser.Load(argv[0], &err)) {
+    fprintf(stderr, "error loading '%s': %s\n", argv[0], err.c_str());
+    return 1;
+  }
+  BuildLog log;
+  if (!log.Load(argv[1], &err)) {
+    fprintf(stderr, "error loading '%s': %s\n", argv[1], err.c_str());
+    return 1;
+  }
+  Node* target = state.LookupNode(argv[2]);
+  if (!target) {
+    fprintf(stderr, "unknown target '%s'\n", argv[2]);
+    return 1;
+  }
+  CompareSchedules(&state, &log, target, parallelism);
+  return 0;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "replay") == 0)
+    return Replay(argc - 2, argv + 2);
+
+  int width = 50000;
+  if (argc > 1)
+    width = atoi(argv[1]);
+  int depth = 100000;
+  if (argc > 2)
+    depth = atoi(argv[2]);
+
+  State state;
+  Node* target = BuildWideGraph(&state, width);
+  DirtyAll(&state);
+
+  Plan plan;
+  string err;
+  double start = Now();
+  if (!plan.AddTarget(target, &err)) {
+    fprintf(stderr, "AddTarget: %s\n", err.c_str());
+    return 1;
+  }
+  double add_time = Now() - start;
+
+  start = Now();
+  int edges = RunPlan(&plan);
+  double run_time = Now() - start;
+  if (plan.more_to_do()) {
+    fprintf(stderr, "plan did not finish\n");
+    return 1;
+  }
+
+  printf("wide graph (%d objects): AddTarget %.1fms, "
+         "scheduled %d edges in %.1fms\n",
+         width, add_time * 1000, edges, run_time * 1000);
+
+  {
+    State deep_state;
+    Node* deep_target = BuildChain(&deep_state, depth);
+    DirtyAll(&deep_state);
+    Plan deep_plan;
+    start = Now();
+    if (!deep_plan.AddTarget(deep_target, &err)) {
+      fprintf(stderr, "AddTarget: %s\n", err.c_str());
+      return 1;
+    }
+    add_time = Now() - start;
+    start = Now();
+    edges = RunPlan(&deep_plan);
+    run_time = Now() - start;
+    printf("chain (%d deep): AddTarget %.1fms, "
+           "scheduled %d edges in %.1fms\n",
+           depth, add_time * 1000, edges, run_time * 1000);
+  }
+
+  State chain_state;
+  BuildLog chain_log;
+  Node* chain_target = BuildChainGraph(&chain_state, &chain_log, 640);
+  CompareSchedules(&chain_state, &chain_log, chain_target, 64);
+  return 0;
+}
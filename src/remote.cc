@@ -0,0 +1,724 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "remote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "build_log.h"
+#include "graph.h"
+#include "subprocess.h"
+#include "util.h"
+
+void AppendMessage(const vector<string>& fields, string* out) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%d\n", (int)fields.size());
+  out->append(buf);
+  for (vector<string>::const_iterator i = fields.begin(); i != fields.end();
+       ++i) {
+    snprintf(buf, sizeof(buf), "%d:", (int)i->size());
+    out->append(buf);
+    out->append(*i);
+  }
+}
+
+namespace {
+
+// Read a decimal number ending in |terminator| from |buf| at |*pos|.
+// Returns -1 if the buffer ends first, -2 if it isn't a number.
+long ReadNumber(const string& buf, size_t* pos, char terminator) {
+  long value = 0;
+  size_t i = *pos;
+  for (; i < buf.size() && buf[i] != terminator; ++i) {
+    if (buf[i] < '0' || buf[i] > '9' || i - *pos > 9)
+      return -2;
+    value = value * 10 + buf[i] - '0';
+  }
+  if (i == buf.size())
+    return -1;
+  if (i == *pos)
+    return -2;
+  *pos = i + 1;
+  return value;
+}
+
+// Write all of |data| to the blocking socket |fd|.
+bool WriteAll(int fd, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t len = send(fd, data.data() + written, data.size() - written,
+                       MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    written += len;
+  }
+  return true;
+}
+
+// Split "host:port".
+bool SplitAddress(const string& address, string* host, string* port,
+                  string* err) {
+  string::size_type colon = address.rfind(':');
+  if (colon == string::npos) {
+    *err = "expected host:port, got '" + address + "'";
+    return false;
+  }
+  *host = address.substr(0, colon);
+  *port = address.substr(colon + 1);
+  return true;
+}
+
+}  // anonymous namespace
+
+bool ParseMessage(string* buf, vector<string>* fields, string* err) {
+  size_t pos = 0;
+  long count = ReadNumber(*buf, &pos, '\n');
+  if (count == -1)
+    return false;
+  if (count < 0) {
+    *err = "bad message header";
+    return false;
+  }
+  vector<string> result;
+  for (long i = 0; i < count; ++i) {
+    long len = ReadNumber(*buf, &pos, ':');
+    if (len == -1 || (len >= 0 && pos + len > buf->size()))
+      return false;  // Wait for more data.
+    if (len < 0) {
+      *err = "bad field length";
+      return false;
+    }
+    result.push_back(buf->substr(pos, len));
+    pos += len;
+  }
+  buf->erase(0, pos);
+  fields->swap(result);
+  return true;
+}
+
+int ConnectToWorker(const string& address, string* err) {
+  string host, port;
+  if (!SplitAddress(address, &host, &port, err))
+    return -1;
+
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs;
+  int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs);
+  if (ret != 0) {
+    *err = address + ": " + gai_strerror(ret);
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* a = addrs; a; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+      break;
+    *err = address + ": " + strerror(errno);
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrs);
+  if (fd < 0)
+    return -1;
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+RemoteCommandRunner::~RemoteCommandRunner() {
+  for (vector<Worker*>::iterator i = workers_.begin(); i != workers_.end();
+       ++i) {
+    if ((*i)->fd_ >= 0)
+      close((*i)->fd_);
+    delete *i;
+  }
+}
+
+bool RemoteCommandRunner::AddWorker(const string& address, string* err) {
+  int fd = ConnectToWorker(address, err);
+  if (fd < 0)
+    return false;
+
+  Worker* worker = new Worker;
+  worker->address_ = address;
+  worker->fd_ = fd;
+  worker->capacity_ = 0;
+  worker->running_ = 0;
+
+  // Wait for the greeting, which tells us how much work to send.
+  vector<string> fields;
+  for (;;) {
+    if (ParseMessage(&worker->buf_, &fields, err))
+      break;
+    char buf[4 << 10];
+    ssize_t len = err->empty() ? read(fd, buf, sizeof(buf)) : -1;
+    if (len <= 0) {
+      if (err->empty())
+        *err = address + ": connection closed before greeting";
+      close(fd);
+      delete worker;
+      return false;
+    }
+    worker->buf_.append(buf, len);
+  }
+  if (fields.size() != 2 || fields[0] != "hello" ||
+      atoi(fields[1].c_str()) <= 0) {
+    *err = address + ": unexpected greeting from worker";
+    close(fd);
+    delete worker;
+    return false;
+  }
+  worker->capacity_ = atoi(fields[1].c_str());
+  workers_.push_back(worker);
+  return true;
+}
+
+int RemoteCommandRunner::capacity() const {
+  int capacity = 0;
+  for (vector<Worker*>::const_iterator i = workers_.begin();
+       i != workers_.end(); ++i) {
+    if ((*i)->fd_ >= 0)
+      capacity += (*i)->capacity_;
+  }
+  return capacity;
+}
+
+bool RemoteCommandRunner::CanRunMore() {
+  return running_ < capacity();
+}
+
+bool RemoteCommandRunner::StartCommand(Edge* edge) {
+  // Send it to the least busy worker, relative to its size.
+  Worker* worker = NULL;
+  for (vector<Worker*>::iterator i = workers_.begin(); i != workers_.end();
+       ++i) {
+    Worker* w = *i;
+    if (w->fd_ < 0 || w->running_ >= w->capacity_)
+      continue;
+    if (!worker ||
+        w->running_ * worker->capacity_ < worker->running_ * w->capacity_) {
+      worker = w;
+    }
+  }
+  if (!worker)
+    return false;
+
+  int id = next_id_++;
+  char id_str[16];
+  snprintf(id_str, sizeof(id_str), "%d", id);
+  vector<string> fields;
+  fields.push_back("run");
+  fields.push_back(id_str);
+  fields.push_back(edge->EvaluateCommand());
+  // Only explicit inputs must exist; implicit ones may legitimately be
+  // missing.
+  int explicit_deps = edge->inputs_.size() - edge->implicit_deps_ -
+      edge->order_only_deps_;
+  char count[16];
+  snprintf(count, sizeof(count), "%d", explicit_deps);
+  fields.push_back(count);
+  for (int i = 0; i < explicit_deps; ++i)
+    fields.push_back(edge->inputs_[i]->file_->path_);
+  snprintf(count, sizeof(count), "%d", (int)edge->outputs_.size());
+  fields.push_back(count);
+  for (vector<Node*>::iterator i = edge->outputs_.begin();
+       i != edge->outputs_.end(); ++i) {
+    fields.push_back((*i)->file_->path_);
+  }
+  snprintf(count, sizeof(count), "%d", edge->rule_->timeout_);
+  fields.push_back(count);
+  string message;
+  AppendMessage(fields, &message);
+
+  Running running = { edge, worker };
+  requests_[id] = running;
+  ++worker->running_;
+  ++running_;
+  if (!WriteAll(worker->fd_, message))
+    DropWorker(worker, strerror(errno));
+  return true;
+}
+
+bool RemoteCommandRunner::WaitForCommands(int timeout_ms) {
+  if (running_ == 0)
+    return false;
+
+  while (finished_.empty()) {
+    vector<pollfd> fds;
+    vector<Worker*> polled;
+    for (vector<Worker*>::iterator i = workers_.begin();
+         i != workers_.end(); ++i) {
+      if ((*i)->fd_ < 0 || (*i)->running_ == 0)
+        continue;
+      pollfd pfd = { (*i)->fd_, POLLIN, 0 };
+      fds.push_back(pfd);
+      polled.push_back(*i);
+    }
+    if (fds.empty())
+      return false;
+
+    int ret = poll(&fds[0], fds.size(), timeout_ms);
+    if (ret < 0) {
+      // Let the builder see what the signal asked for.
+      if (errno == EINTR)
+        break;
+      Fatal("poll: %s", strerror(errno));
+    }
+    if (ret == 0)
+      break;
+    for (size_t i = 0; i < fds.size(); ++i) {
+      if (fds[i].revents)
+        ReadFromWorker(polled[i]);
+    }
+  }
+  return true;
+}
+
+bool RemoteCommandRunner::ReadFromWorker(Worker* worker) {
+  char buf[64 << 10];
+  ssize_t len = read(worker->fd_, buf, sizeof(buf));
+  if (len < 0 && errno == EINTR)
+    return true;
+  if (len <= 0) {
+    DropWorker(worker, len < 0 ? strerror(errno) : "connection closed");
+    return false;
+  }
+  worker->buf_.append(buf, len);
+
+  vector<string> fields;
+  string err;
+  while (ParseMessage(&worker->buf_, &fields, &err)) {
+    map<int, Running>::iterator i;
+    if (fields.size() != 5 || fields[0] != "done" ||
+        (i = requests_.find(atoi(fields[1].c_str()))) == requests_.end() ||
+        i->second.worker != worker) {
+      DropWorker(worker, "unexpected message");
+      return false;
+    }
+    Finished finished;
+    finished.edge = i->second.edge;
+    finished.success = fields[2] == "1";
+    finished.output = fields[3];
+    finished.usage = fields[4];
+    finished_.push(finished);
+    requests_.erase(i);
+    --worker->running_;
+    --running_;
+  }
+  if (!err.empty()) {
+    DropWorker(worker, err);
+    return false;
+  }
+  return true;
+}
+
+void RemoteCommandRunner::DropWorker(Worker* worker, const string& why) {
+  close(worker->fd_);
+  worker->fd_ = -1;
+  for (map<int, Running>::iterator i = requests_.begin();
+       i != requests_.end();) {
+    if (i->second.worker != worker) {
+      ++i;
+      continue;
+    }
+    Finished finished;
+    finished.edge = i->second.edge;
+    finished.success = false;
+    finished.output = "ninja: lost worker " + worker->address_ + ": " + why;
+    finished_.push(finished);
+    requests_.erase(i++);
+    --running_;
+  }
+  worker->running_ = 0;
+}
+
+Edge* RemoteCommandRunner::NextFinishedCommand(bool* success,
+                                               ResourceUsage* usage) {
+  if (finished_.empty())
+    return NULL;
+  Finished finished = finished_.front();
+  finished_.pop();
+
+  *success = finished.success;
+  sscanf(finished.usage.c_str(), "%d %d %ld %ld %ld", &usage->user_ms,
+         &usage->system_ms, &usage->max_rss_kb, &usage->in_blocks,
+         &usage->out_blocks);
+  if (!finished.success || !finished.output.empty()) {
+    printf("\n%s%s\n", finished.success ? "" : "FAILED: ",
+           finished.edge->EvaluateCommand().c_str());
+    if (!finished.output.empty())
+      printf("%s\n", finished.output.c_str());
+  }
+  return finished.edge;
+}
+
+WorkerServer::~WorkerServer() {
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+}
+
+bool WorkerServer::Listen(const string& address, string* err) {
+  string host, port;
+  if (!SplitAddress(address, &host, &port, err))
+    return false;
+
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* addrs;
+  int ret = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(),
+                        &hints, &addrs);
+  if (ret != 0) {
+    *err = address + ": " + gai_strerror(ret);
+    return false;
+  }
+  for (addrinfo* a = addrs; a; a = a->ai_next) {
+    listen_fd_ = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (listen_fd_ < 0)
+      continue;
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd_, a->ai_addr, a->ai_addrlen) == 0 &&
+        listen(listen_fd_, 16) == 0) {
+      break;
+    }
+    *err = address + ": " + strerror(errno);
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+  freeaddrinfo(addrs);
+  if (listen_fd_ < 0)
+    return false;
+  fcntl(listen_fd_, F_SETFD, FD_CLOEXEC);
+  err->clear();
+  return true;
+}
+
+int WorkerServer::port() const {
+  sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(listen_fd_, (sockaddr*)&addr, &len) < 0)
+    return -1;
+  if (addr.ss_family == AF_INET6)
+    return ntohs(((sockaddr_in6*)&addr)->sin6_port);
+  return ntohs(((sockaddr_in*)&addr)->sin_port);
+}
+
+void WorkerServer::Serve() {
+  for (;;)
+    DoWork();
+}
+
+void WorkerServer::DoWork() {
+  // What each pollfd is: a client connection, a job's output pipe, one
+  // of leftovers_, or (first) the listening socket.
+  vector<pollfd> fds;
+  vector<Client*> fd_clients;
+  vector<Job*> fd_jobs;
+
+  pollfd listen_pfd = { listen_fd_, POLLIN, 0 };
+  fds.push_back(listen_pfd);
+  fd_clients.push_back(NULL);
+  fd_jobs.push_back(NULL);
+  for (vector<Client*>::iterator i = clients_.begin(); i != clients_.end();
+       ++i) {
+    pollfd pfd = { (*i)->fd_, POLLIN, 0 };
+    if (!(*i)->out_.empty())
+      pfd.events |= POLLOUT;
+    fds.push_back(pfd);
+    fd_clients.push_back(*i);
+    fd_jobs.push_back(NULL);
+  }
+  for (vector<Job*>::iterator i = running_.begin(); i != running_.end();
+       ++i) {
+    int job_fds[3] = { (*i)->subproc->stdout_.fd_,
+                       (*i)->subproc->stderr_.fd_,
+                       (*i)->subproc->pidfd_.fd_ };
+    for (int j = 0; j < 3; ++j) {
+      if (job_fds[j] < 0)
+        continue;
+      pollfd pfd = { job_fds[j], POLLIN, 0 };
+      fds.push_back(pfd);
+      fd_clients.push_back(NULL);
+      fd_jobs.push_back(*i);
+    }
+  }
+  for (vector<int>::iterator i = leftovers_.begin(); i != leftovers_.end();
+       ++i) {
+    pollfd pfd = { *i, POLLIN, 0 };
+    fds.push_back(pfd);
+    fd_clients.push_back(NULL);
+    fd_jobs.push_back(NULL);
+  }
+
+  if (poll(&fds[0], fds.size(), KillOverdueJobs()) < 0) {
+    if (errno == EINTR)
+      return;
+    Fatal("poll: %s", strerror(errno));
+  }
+  KillOverdueJobs();
+
+  // A job's exit closes its pipes, whose events may come later in the
+  // batch; finish jobs once the batch is done.
+  vector<Job*> finished;
+  for (size_t i = 0; i < fds.size(); ++i) {
+    if (!fds[i].revents)
+      continue;
+    if (i == 0) {
+      Accept();
+    } else if (Client* client = fd_clients[i]) {
+      bool alive = true;
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        alive = ReadFromClient(client);
+      if (alive && (fds[i].revents & POLLOUT))
+        alive = WriteToClient(client);
+      if (!alive)
+        CloseClient(client);
+    } else if (Job* job = fd_jobs[i]) {
+      if (job->subproc->done())
+        continue;
+      job->subproc->OnFDReady(fds[i].fd);
+      if (job->subproc->done())
+        finished.push_back(job);
+    } else if (!Subprocess::DrainPipe(fds[i].fd)) {
+      close(fds[i].fd);
+      leftovers_.erase(find(leftovers_.begin(), leftovers_.end(),
+                            fds[i].fd));
+    }
+  }
+  for (vector<Job*>::iterator i = finished.begin(); i != finished.end(); ++i)
+    FinishJob(*i);
+  StartQueuedJobs();
+}
+
+void WorkerServer::Accept() {
+  int fd = accept(listen_fd_, NULL, NULL);
+  if (fd < 0)
+    return;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  Client* client = new Client;
+  client->fd_ = fd;
+  clients_.push_back(client);
+
+  vector<string> hello;
+  hello.push_back("hello");
+  char capacity[16];
+  snprintf(capacity, sizeof(capacity), "%d", capacity_);
+  hello.push_back(capacity);
+  AppendMessage(hello, &client->out_);
+}
+
+bool WorkerServer::ReadFromClient(Client* client) {
+  char buf[64 << 10];
+  ssize_t len = read(client->fd_, buf, sizeof(buf));
+  if (len < 0)
+    return errno == EINTR || errno == EAGAIN;
+  if (len == 0)
+    return false;
+  client->in_.append(buf, len);
+
+  vector<string> fields;
+  string err;
+  while (ParseMessage(&client->in_, &fields, &err)) {
+    if (!HandleRequest(client, fields))
+      return false;
+  }
+  return err.empty() && client->in_.size() <= kMaxMessageSize;
+}
+
+bool WorkerServer::WriteToClient(Client* client) {
+  ssize_t len = send(client->fd_, client->out_.data(), client->out_.size(),
+                     MSG_NOSIGNAL);
+  if (len < 0)
+    return errno == EINTR || errno == EAGAIN;
+  client->out_.erase(0, len);
+  return true;
+}
+
+bool WorkerServer::HandleRequest(Client* client,
+                                 const vector<string>& fields) {
+  // "run" ID COMMAND NINPUTS INPUT... NOUTPUTS OUTPUT...
+  if (fields.size() < 2)
+    return false;
+  const string& id = fields[1];
+  if (fields[0] != "run") {
+    Reply(client, id, false,
+          "ninja_worker: unknown request '" + fields[0] + "'\n");
+    return true;
+  }
+  size_t pos = 3;
+  size_t inputs = 0;
+  if (fields.size() >= 5)
+    inputs = atoi(fields[pos++].c_str());
+  if (fields.size() < 5 || pos + inputs >= fields.size()) {
+    Reply(client, id, false, "ninja_worker: malformed request\n");
+    return true;
+  }
+  for (size_t i = 0; i < inputs; ++i) {
+    const string& input = fields[pos++];
+    struct stat st;
+    if (stat(input.c_str(), &st) < 0) {
+      Reply(client, id, false,
+            "ninja_worker: missing input '" + input + "'\n");
+      return true;
+    }
+  }
+
+  Job* job = new Job;
+  job->client = client;
+  job->id = id;
+  job->command = fields[2];
+  size_t outputs = atoi(fields[pos++].c_str());
+  for (size_t i = 0; i < outputs && pos < fields.size(); ++i)
+    job->outputs.push_back(fields[pos++]);
+  job->timeout = pos < fields.size() ? atoi(fields[pos].c_str()) : 0;
+  job->timed_out = false;
+  job->subproc = NULL;
+  queued_.push(job);
+  return true;
+}
+
+void WorkerServer::StartQueuedJobs() {
+  while (!queued_.empty() && (int)running_.size() < capacity_) {
+    Job* job = queued_.front();
+    queued_.pop();
+    job->subproc = new Subprocess;
+    job->subproc->Start(job->command, true);
+    gettimeofday(&job->deadline, NULL);
+    job->deadline.tv_sec += job->timeout;
+    running_.push_back(job);
+  }
+}
+
+int WorkerServer::KillOverdueJobs() {
+  timeval now;
+  gettimeofday(&now, NULL);
+  int ms = -1;
+  for (vector<Job*>::iterator i = running_.begin(); i != running_.end();
+       ++i) {
+    Job* job = *i;
+    if (job->timeout <= 0 || job->timed_out)
+      continue;
+    timeval left;
+    timersub(&job->deadline, &now, &left);
+    if (left.tv_sec < 0) {
+      job->subproc->Kill();
+      job->timed_out = true;
+      continue;
+    }
+    int left_ms = left.tv_sec * 1000 + left.tv_usec / 1000 + 1;
+    if (ms < 0 || left_ms < ms)
+      ms = left_ms;
+  }
+  return ms;
+}
+
+void WorkerServer::FinishJob(Job* job) {
+  running_.erase(find(running_.begin(), running_.end(), job));
+  bool success = job->subproc->Finish();
+  string output = job->subproc->stdout_.buf_ + job->subproc->stderr_.buf_;
+  if (job->timed_out) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "ninja_worker: killed after %ds\n",
+             job->timeout);
+    output += buf;
+    success = false;
+  }
+  if (success) {
+    for (vector<string>::iterator i = job->outputs.begin();
+         i != job->outputs.end(); ++i) {
+      struct stat st;
+      if (stat(i->c_str(), &st) < 0) {
+        output += "ninja_worker: command did not produce '" + *i + "'\n";
+        success = false;
+      }
+    }
+  }
+  const struct rusage& ru = job->subproc->rusage_;
+  char usage[128];
+  snprintf(usage, sizeof(usage), "%ld %ld %ld %ld %ld",
+           ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000,
+           ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000,
+           ru.ru_maxrss, ru.ru_inblock, ru.ru_oublock);
+  if (job->client)
+    Reply(job->client, job->id, success, output, usage);
+  job->subproc->ReleasePipes(&leftovers_);
+  delete job->subproc;
+  delete job;
+}
+
+void WorkerServer::Reply(Client* client, const string& id, bool success,
+                         const string& output, const string& usage) {
+  vector<string> fields;
+  fields.push_back("done");
+  fields.push_back(id);
+  fields.push_back(success ? "1" : "0");
+  fields.push_back(output);
+  fields.push_back(usage);
+  AppendMessage(fields, &client->out_);
+  WriteToClient(client);
+}
+
+void WorkerServer::CloseClient(Client* client) {
+  // Its running jobs finish anyway, but nobody hears about them; queued
+  // ones are dropped.
+  for (vector<Job*>::iterator i = running_.begin(); i != running_.end();
+       ++i) {
+    if ((*i)->client == client)
+      (*i)->client = NULL;
+  }
+  queue<Job*> queued;
+  while (!queued_.empty()) {
+    Job* job = queued_.front();
+    queued_.pop();
+    if (job->client == client)
+      delete job;
+    else
+      queued.push(job);
+  }
+  queued_.swap(queued);
+
+  close(client->fd_);
+  clients_.erase(find(clients_.begin(), clients_.end(), client));
+  delete client;
+}
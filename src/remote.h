@@ -0,0 +1,177 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_REMOTE_H_
+#define NINJA_REMOTE_H_
+
+// Running commands on worker daemons (ninja_worker) over TCP.
+//
+// Every message is a list of strings: the number of strings in decimal
+// followed by '\n', then each string as its length in decimal, ':', and
+// its bytes.  The conversation is:
+//   worker -> ninja:  "hello" CAPACITY
+//   ninja -> worker:  "run" ID COMMAND NINPUTS INPUT... NOUTPUTS OUTPUT...
+//                     TIMEOUT
+//   worker -> ninja:  "done" ID SUCCESS OUTPUT USAGE
+// where the inputs are the command's explicit inputs, TIMEOUT is the
+// rule's timeout in seconds (0 for none), SUCCESS is "1" or
+// "0", OUTPUT is the command's stdout and stderr and USAGE is its user
+// and system milliseconds, peak RSS in KB and blocks read and written,
+// separated by spaces.  The worker runs commands in its own directory,
+// which must see the same files as ninja's (the same machine, or a
+// shared filesystem); it checks the inputs exist before running a command
+// and that the outputs exist afterwards.  A request the worker can't make
+// sense of gets a failed "done" if it has an ID; otherwise, or if a
+// message grows past kMaxMessageSize, the worker hangs up.
+//
+// A worker runs whatever it is sent, so it only listens on localhost
+// unless told otherwise.
+
+#include <sys/time.h>
+
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "build.h"
+
+struct Subprocess;
+
+// Append |fields| to |out| as one message.
+void AppendMessage(const vector<string>& fields, string* out);
+// If |buf| starts with a complete message, move it into |fields| and
+// return true.  Sets |err| if |buf| isn't a message at all.
+bool ParseMessage(string* buf, vector<string>* fields, string* err);
+
+// The most a worker buffers from one ninja before hanging up on it.
+const size_t kMaxMessageSize = 64 << 20;
+
+// Connect to "host:port"; returns the socket or -1 and fills in |err|.
+int ConnectToWorker(const string& address, string* err);
+
+// A CommandRunner that sends commands to workers.  Its parallelism is the
+// total capacity the workers announce, not the local -j setting.
+struct RemoteCommandRunner : public CommandRunner {
+  RemoteCommandRunner() : running_(0), next_id_(0) {}
+  virtual ~RemoteCommandRunner();
+
+  // Connect to the worker at |address| and wait for its greeting.
+  bool AddWorker(const string& address, string* err);
+
+  virtual bool CanRunMore();
+  virtual bool StartCommand(Edge* edge);
+  virtual bool WaitForCommands(int timeout_ms);
+  virtual Edge* NextFinishedCommand(bool* success, ResourceUsage* usage);
+
+  // Total number of commands the workers will run at once.
+  int capacity() const;
+
+  struct Worker {
+    string address_;
+    int fd_;
+    int capacity_;
+    int running_;
+    // Bytes received but not yet parsed.
+    string buf_;
+  };
+  // Read whatever |worker| has sent and handle complete messages.
+  // Returns false if the connection is gone.
+  bool ReadFromWorker(Worker* worker);
+  // Fail every command running on |worker| and stop using it.
+  void DropWorker(Worker* worker, const string& why);
+
+  struct Finished {
+    Edge* edge;
+    bool success;
+    string output;
+    // The USAGE field of the reply.
+    string usage;
+  };
+
+  vector<Worker*> workers_;
+  int running_;
+  int next_id_;
+  // Commands sent and not yet answered, by request id.
+  struct Running {
+    Edge* edge;
+    Worker* worker;
+  };
+  map<int, Running> requests_;
+  queue<Finished> finished_;
+};
+
+// The worker side: accepts connections from ninja processes and runs
+// their commands, at most |capacity| at a time across all of them.
+struct WorkerServer {
+  WorkerServer(int capacity) : capacity_(capacity), listen_fd_(-1) {}
+  ~WorkerServer();
+
+  // Listen on |address| ("host:port"; port 0 picks a free one).
+  bool Listen(const string& address, string* err);
+  // The port we ended up listening on.
+  int port() const;
+  // Serve requests until killed.
+  void Serve();
+  // Wait for and handle one round of events.
+  void DoWork();
+
+  struct Client;
+  struct Job {
+    Client* client;
+    string id;
+    string command;
+    vector<string> outputs;
+    // Seconds the command may run, or 0; and when it has to be done by,
+    // once started.
+    int timeout;
+    timeval deadline;
+    bool timed_out;
+    Subprocess* subproc;
+  };
+  struct Client {
+    int fd_;
+    string in_;
+    string out_;
+  };
+
+  void Accept();
+  // Read from |client|; returns false once it has gone away.
+  bool ReadFromClient(Client* client);
+  bool WriteToClient(Client* client);
+  // Queue the job |fields| asks for.  Returns false if the request is
+  // too broken to answer.
+  bool HandleRequest(Client* client, const vector<string>& fields);
+  void StartQueuedJobs();
+  // Kill the jobs that have run past their timeout, and return the
+  // milliseconds until the next one is due, or -1 if none is.
+  int KillOverdueJobs();
+  void FinishJob(Job* job);
+  void Reply(Client* client, const string& id, bool success,
+             const string& output, const string& usage = "0 0 0 0 0");
+  void CloseClient(Client* client);
+
+  int capacity_;
+  int listen_fd_;
+  vector<Client*> clients_;
+  // Jobs waiting for a free slot, and those running.
+  queue<Job*> queued_;
+  vector<Job*> running_;
+  // Output pipes of finished jobs that something they left running still
+  // holds; see Subprocess::ReleasePipes().
+  vector<int> leftovers_;
+};
+
+#endif  // NINJA_REMOTE_H_
@@ -0,0 +1,302 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "remote.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "build_log.h"
+#include "test.h"
+
+TEST(RemoteMessage, RoundTrip) {
+  vector<string> fields;
+  fields.push_back("run");
+  fields.push_back("");
+  fields.push_back("echo 'a\nb' 12:34");
+  string buf;
+  AppendMessage(fields, &buf);
+  AppendMessage(fields, &buf);
+
+  // Nothing comes out until a whole message is there.
+  string partial = buf.substr(0, buf.size() / 2 - 1);
+  vector<string> parsed;
+  string err;
+  EXPECT_FALSE(ParseMessage(&partial, &parsed, &err));
+  EXPECT_EQ("", err);
+
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(ParseMessage(&buf, &parsed, &err));
+    EXPECT_EQ(fields, parsed);
+  }
+  EXPECT_EQ("", buf);
+  EXPECT_FALSE(ParseMessage(&buf, &parsed, &err));
+
+  buf = "2\nx:";
+  EXPECT_FALSE(ParseMessage(&buf, &parsed, &err));
+  EXPECT_EQ("bad field length", err);
+}
+
+// Runs a WorkerServer with capacity 2 in a child process, in a scratch
+// directory.
+struct RemoteTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    char dir[] = "/tmp/ninja_remote_test-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+
+    WorkerServer server(2);
+    string err;
+    ASSERT_TRUE(server.Listen("127.0.0.1:0", &err)) << err;
+    char address[32];
+    snprintf(address, sizeof(address), "127.0.0.1:%d", server.port());
+    address_ = address;
+
+    worker_pid_ = fork();
+    ASSERT_GE(worker_pid_, 0);
+    if (worker_pid_ == 0) {
+      if (chdir(dir_.c_str()) < 0)
+        _exit(1);
+      server.Serve();
+    }
+  }
+
+  virtual void TearDown() {
+    kill(worker_pid_, SIGKILL);
+    waitpid(worker_pid_, NULL, 0);
+    system(("rm -rf " + dir_).c_str());
+  }
+
+  // Run |edge| through |runner| and wait for the answer.
+  Edge* Run(RemoteCommandRunner* runner, Edge* edge, bool* success) {
+    EXPECT_TRUE(runner->StartCommand(edge));
+    EXPECT_TRUE(runner->WaitForCommands(-1));
+    ResourceUsage usage;
+    return runner->NextFinishedCommand(success, &usage);
+  }
+
+  bool Exists(const string& path) {
+    struct stat st;
+    return stat((dir_ + "/" + path).c_str(), &st) == 0;
+  }
+
+  string dir_;
+  string address_;
+  pid_t worker_pid_;
+};
+
+TEST_F(RemoteTest, Capacity) {
+  RemoteCommandRunner runner;
+  string err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+  // Each connection reports the worker's capacity.
+  EXPECT_EQ(4, runner.capacity());
+
+  EXPECT_FALSE(runner.AddWorker("127.0.0.1:1", &err));
+  EXPECT_NE("", err);
+}
+
+TEST_F(RemoteTest, RunCommands) {
+  AssertParse(&state_,
+"rule touch\n"
+"  command = touch $out\n"
+"build in: touch\n"
+"build mid: cat in\n"
+"build out: cat mid\n");
+  RemoteCommandRunner runner;
+  string err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+
+  Edge* edges[3];
+  edges[0] = GetNode("in")->in_edge_;
+  edges[1] = GetNode("mid")->in_edge_;
+  edges[2] = GetNode("out")->in_edge_;
+  for (int i = 0; i < 3; ++i) {
+    bool success = false;
+    EXPECT_EQ(edges[i], Run(&runner, edges[i], &success));
+    EXPECT_TRUE(success);
+  }
+  EXPECT_TRUE(Exists("out"));
+  EXPECT_TRUE(runner.CanRunMore());
+  EXPECT_FALSE(runner.WaitForCommands(-1));
+}
+
+TEST_F(RemoteTest, Parallel) {
+  AssertParse(&state_,
+"rule sleep\n"
+"  command = sleep 0.1 && touch $out\n"
+"build a: sleep\n"
+"build b: sleep\n"
+"build c: sleep\n");
+  RemoteCommandRunner runner;
+  string err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+
+  EXPECT_TRUE(runner.StartCommand(GetNode("a")->in_edge_));
+  EXPECT_TRUE(runner.CanRunMore());
+  EXPECT_TRUE(runner.StartCommand(GetNode("b")->in_edge_));
+  EXPECT_FALSE(runner.CanRunMore());
+
+  int finished = 0;
+  while (finished < 2) {
+    ASSERT_TRUE(runner.WaitForCommands(-1));
+    bool success;
+    ResourceUsage usage;
+    while (runner.NextFinishedCommand(&success, &usage)) {
+      EXPECT_TRUE(success);
+      ++finished;
+    }
+  }
+  EXPECT_TRUE(runner.CanRunMore());
+  EXPECT_TRUE(Exists("a"));
+  EXPECT_TRUE(Exists("b"));
+  EXPECT_FALSE(Exists("c"));
+}
+
+TEST_F(RemoteTest, Failures) {
+  AssertParse(&state_,
+"rule false\n"
+"  command = false\n"
+"rule true\n"
+"  command = true\n"
+"build missing_input: cat nonexistent\n"
+"build fails: false\n"
+"build no_output: true\n");
+  RemoteCommandRunner runner;
+  string err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+
+  const char* outputs[] = { "missing_input", "fails", "no_output" };
+  for (int i = 0; i < 3; ++i) {
+    bool success = true;
+    Edge* edge = GetNode(outputs[i])->in_edge_;
+    EXPECT_EQ(edge, Run(&runner, edge, &success));
+    EXPECT_FALSE(success) << outputs[i];
+  }
+}
+
+TEST_F(RemoteTest, LostWorker) {
+  AssertParse(&state_,
+"rule sleep\n"
+"  command = sleep 2\n"
+"build a: sleep\n");
+  RemoteCommandRunner runner;
+  string err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+
+  EXPECT_TRUE(runner.StartCommand(GetNode("a")->in_edge_));
+  kill(worker_pid_, SIGKILL);
+  bool success = true;
+  ASSERT_TRUE(runner.WaitForCommands(-1));
+  ResourceUsage usage;
+  EXPECT_EQ(GetNode("a")->in_edge_,
+            runner.NextFinishedCommand(&success, &usage));
+  EXPECT_FALSE(success);
+  // Nothing is left to run commands on.
+  EXPECT_FALSE(runner.CanRunMore());
+}
+
+// Requests the worker can't run get a failed reply rather than silence.
+TEST_F(RemoteTest, BadRequests) {
+  string err;
+  int fd = ConnectToWorker(address_, &err);
+  ASSERT_GE(fd, 0) << err;
+
+  vector<string> requests[2];
+  requests[0].push_back("frobnicate");
+  requests[0].push_back("7");
+  requests[1].push_back("run");
+  requests[1].push_back("8");
+  requests[1].push_back("true");
+  string message;
+  for (int i = 0; i < 2; ++i)
+    AppendMessage(requests[i], &message);
+  ASSERT_EQ((ssize_t)message.size(),
+            write(fd, message.data(), message.size()));
+
+  // The greeting, then a failure for each request.
+  const char* ids[] = { NULL, "7", "8" };
+  string buf;
+  for (int i = 0; i < 3; ++i) {
+    vector<string> fields;
+    while (!ParseMessage(&buf, &fields, &err)) {
+      ASSERT_EQ("", err);
+      char data[4 << 10];
+      ssize_t len = read(fd, data, sizeof(data));
+      ASSERT_GT(len, 0);
+      buf.append(data, len);
+    }
+    if (!ids[i])
+      continue;
+    ASSERT_EQ(5u, fields.size());
+    EXPECT_EQ("done", fields[0]);
+    EXPECT_EQ(ids[i], fields[1]);
+    EXPECT_EQ("0", fields[2]);
+  }
+
+  // Without even an id there's nobody to answer, so the worker hangs up.
+  message.clear();
+  AppendMessage(vector<string>(1, "run"), &message);
+  ASSERT_EQ((ssize_t)message.size(),
+            write(fd, message.data(), message.size()));
+  char data[16];
+  EXPECT_EQ(0, read(fd, data, sizeof(data)));
+  close(fd);
+}
+
+TEST_F(RemoteTest, Usage) {
+  AssertParse(&state_,
+"rule touch\n"
+"  command = touch $out\n"
+"build a: touch\n");
+  RemoteCommandRunner runner;
+  string err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+
+  Edge* edge = GetNode("a")->in_edge_;
+  EXPECT_TRUE(runner.StartCommand(edge));
+  EXPECT_TRUE(runner.WaitForCommands(-1));
+  bool success = false;
+  ResourceUsage usage;
+  EXPECT_EQ(edge, runner.NextFinishedCommand(&success, &usage));
+  EXPECT_TRUE(success);
+  // The worker reports what the command used.
+  EXPECT_GT(usage.max_rss_kb, 0);
+}
+
+TEST_F(RemoteTest, Timeout) {
+  AssertParse(&state_,
+"rule slow\n"
+"  command = sleep 10\n"
+"  timeout = 1\n"
+"build a: slow\n");
+  RemoteCommandRunner runner;
+  string err;
+  ASSERT_TRUE(runner.AddWorker(address_, &err)) << err;
+
+  timeval start, end;
+  gettimeofday(&start, NULL);
+  bool success = true;
+  Edge* edge = GetNode("a")->in_edge_;
+  EXPECT_EQ(edge, Run(&runner, edge, &success));
+  gettimeofday(&end, NULL);
+  EXPECT_FALSE(success);
+  EXPECT_LT(end.tv_sec - start.tv_sec, 5);
+}
@@ -17,86 +17,168 @@
 #include <algorithm>
 #include <map>
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 
 #include "util.h"
 
-Subprocess::Stream::Stream() : fd_(-1) {}
+Subprocess::Stream::Stream() : fd_(-1), owner_(NULL) {}
 Subprocess::Stream::~Stream() {
   if (fd_ >= 0)
     close(fd_);
 }
 
-Subprocess::Subprocess() : pid_(-1) {}
+Subprocess::Subprocess()
+    : pid_(-1), status_(0), exited_(false), spawn_failed_(false),
+      used_shell_(false),
+      epoll_fd_(-1), running_index_(0) {
+  stdout_.owner_ = stderr_.owner_ = pidfd_.owner_ = this;
+  memset(&rusage_, 0, sizeof(rusage_));
+}
 Subprocess::~Subprocess() {
   // Reap child if forgotten.
   if (pid_ != -1)
     Finish();
 }
 
-bool Subprocess::Start(const string& command) {
+bool SplitCommand(const string& command, vector<string>* words) {
+  words->clear();
+  string word;
+  for (string::const_iterator i = command.begin(); ; ++i) {
+    if (i == command.end() || *i == ' ' || *i == '\t') {
+      if (!word.empty())
+        words->push_back(word);
+      word.clear();
+      if (i == command.end())
+        break;
+      continue;
+    }
+    // Anything else the shell could give meaning to (quotes, variables,
+    // redirections, globs, separators, comments, ~) needs the shell.
+    unsigned char c = *i;
+    if (!isalnum(c) && c < 0x80 && !strchr("_-./+=,:@%^", c))
+      return false;
+    word += c;
+  }
+  if (words->empty())
+    return false;
+
+  // Variable assignments, and reserved words and builtins that aren't
+  // also programs.
+  const string& first = (*words)[0];
+  if (first.find('=') != string::npos)
+    return false;
+  static const char* const kShellWords[] = {
+    ".", ":", "alias", "bg", "break", "case", "cd", "command", "continue",
+    "do", "done", "elif", "else", "esac", "eval", "exec", "exit", "export",
+    "fc", "fg", "fi", "for", "getopts", "hash", "if", "in", "jobs",
+    "local", "read", "readonly", "return", "set", "shift", "source",
+    "then", "times", "trap", "type", "ulimit", "umask", "unalias",
+    "unset", "until", "wait", "while",
+  };
+  for (size_t i = 0; i < sizeof(kShellWords) / sizeof(kShellWords[0]);
+       ++i) {
+    if (first == kShellWords[i])
+      return false;
+  }
+  return true;
+}
+
+bool Subprocess::Start(const string& command, bool merge_output) {
+  // Close-on-exec keeps other commands from inheriting our ends of the
+  // pipes; dup2() clears it on the child's copies of the write ends.
   int stdout_pipe[2];
-  if (pipe(stdout_pipe) < 0)
+  if (pipe2(stdout_pipe, O_CLOEXEC) < 0)
     Fatal("pipe: %s", strerror(errno));
   stdout_.fd_ = stdout_pipe[0];
 
-  int stderr_pipe[2];
-  if (pipe(stderr_pipe) < 0)
-    Fatal("pipe: %s", strerror(errno));
-  stderr_.fd_ = stderr_pipe[0];
-
-  pid_ = fork();
-  if (pid_ < 0)
-    Fatal("fork: %s", strerror(errno));
-
-  if (pid_ == 0) {
-    close(stdout_pipe[0]);
-    close(stderr_pipe[0]);
-
-    // Track which fd we use to report errors on.
-    int error_pipe = stderr_pipe[1];
-    do {
-      // Open /dev/null over stdin.
-      int devnull = open("/dev/null", O_WRONLY);
-      if (devnull < 0)
-        break;
-      if (dup2(devnull, 0) < 0)
-        break;
-      close(devnull);
-
-      if (dup2(stdout_pipe[1], 1) < 0 ||
-          dup2(stderr_pipe[1], 2) < 0)
-        break;
-
-      // Now can use stderr for errors.
-      error_pipe = 2;
-      close(stdout_pipe[1]);
-      close(stderr_pipe[1]);
+  int stderr_pipe[2] = { -1, stdout_pipe[1] };
+  if (!merge_output) {
+    if (pipe2(stderr_pipe, O_CLOEXEC) < 0)
+      Fatal("pipe: %s", strerror(errno));
+    stderr_.fd_ = stderr_pipe[0];
+  }
 
-      execl("/bin/sh", "/bin/sh", "-c", command.c_str(), NULL);
-    } while (false);
+  // posix_spawn() shares our memory with the child until it execs
+  // (glibc uses CLONE_VM|CLONE_VFORK), so unlike fork() it doesn't have
+  // to copy the page tables of a large build graph for every command.
+  posix_spawn_file_actions_t actions;
+  int err = posix_spawn_file_actions_init(&actions);
+  if (err != 0)
+    Fatal("posix_spawn_file_actions_init: %s", strerror(err));
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], 1);
+  posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], 2);
+  // Commands get the default SIGPIPE even if we (or ninja_worker) ignore
+  // it, so that pipelines like "yes | head" end the way they do in a
+  // shell.  Each command leads its own process group, so that Kill()
+  // reaches whatever it started too.
+  posix_spawnattr_t attr;
+  err = posix_spawnattr_init(&attr);
+  if (err != 0)
+    Fatal("posix_spawnattr_init: %s", strerror(err));
+  sigset_t sigdefault;
+  sigemptyset(&sigdefault);
+  sigaddset(&sigdefault, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attr, &sigdefault);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                  POSIX_SPAWN_SETPGROUP);
 
-    // If we get here, something went wrong; the execl should have
-    // replaced us.
-    char* err = strerror(errno);
-    int unused = write(error_pipe, err, strlen(err));
-    unused = unused;  // If the write fails, there's nothing we can do.
-    _exit(1);
+  // Skip the shell when it would only split the command into words.
+  vector<string> words;
+  used_shell_ = !SplitCommand(command, &words);
+  if (!used_shell_) {
+    vector<char*> argv;
+    for (vector<string>::iterator i = words.begin(); i != words.end(); ++i)
+      argv.push_back(const_cast<char*>(i->c_str()));
+    argv.push_back(NULL);
+    err = posix_spawnp(&pid_, argv[0], &actions, &attr, &argv[0], environ);
+    // The shell runs scripts without a #! line itself.
+    used_shell_ = err == ENOEXEC;
+  }
+  if (used_shell_) {
+    const char* argv[] = { "/bin/sh", "-c", command.c_str(), NULL };
+    err = posix_spawn(&pid_, argv[0], &actions, &attr,
+                      const_cast<char**>(argv), environ);
+  }
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    // Report it as a failed command, as a child that couldn't exec would:
+    // the error on stderr, and the pipes at end of file.
+    pid_ = -1;
+    Stream* stream = merge_output ? &stdout_ : &stderr_;
+    stream->buf_ = (used_shell_ ? "/bin/sh" : words[0]) + ": " +
+                   strerror(err);
+    spawn_failed_ = true;
+  } else {
+    // Without pidfds (before Linux 5.3) this stays -1.
+    pidfd_.fd_ = syscall(SYS_pidfd_open, pid_, 0);
   }
 
   close(stdout_pipe[1]);
-  close(stderr_pipe[1]);
+  if (!merge_output)
+    close(stderr_pipe[1]);
   return true;
 }
 
 void Subprocess::OnFDReady(int fd) {
-  char buf[4 << 10];
+  if (fd == pidfd_.fd_) {
+    OnExit();
+    return;
+  }
+  char buf[64 << 10];
   ssize_t len = read(fd, buf, sizeof(buf));
   Stream* stream = fd == stdout_.fd_ ? &stdout_ : &stderr_;
   if (len > 0) {
@@ -104,48 +186,197 @@ void Subprocess::OnFDReady(int fd) {
   } else {
     if (len < 0)
       Fatal("read: %s", strerror(errno));
-    close(stream->fd_);
-    stream->fd_ = -1;
+    CloseStream(stream);
   }
 }
 
-bool Subprocess::Finish() {
-  assert(pid_ != -1);
-  int status;
-  if (waitpid(pid_, &status, 0) < 0)
-    Fatal("waitpid(%d): %s", pid_, strerror(errno));
+void Subprocess::OnExit() {
+  if (wait4(pid_, &status_, WNOHANG, &rusage_) <= 0)
+    return;  // Not yet, after all.
   pid_ = -1;
+  exited_ = true;
+  CloseStream(&pidfd_);
+
+  // What the child wrote is in the pipes already; anything still to
+  // come is from processes it left behind, which we don't wait for.
+  // Pipes they hold stay open for ReleasePipes().
+  Stream* streams[] = { &stdout_, &stderr_ };
+  for (int i = 0; i < 2; ++i) {
+    Stream* stream = streams[i];
+    if (stream->fd_ < 0)
+      continue;
+    fcntl(stream->fd_, F_SETFL, O_NONBLOCK);
+    char buf[64 << 10];
+    ssize_t len;
+    while ((len = read(stream->fd_, buf, sizeof(buf))) > 0)
+      stream->buf_.append(buf, len);
+    if (len == 0 || (errno != EAGAIN && errno != EINTR))
+      CloseStream(stream);
+  }
+}
 
-  if (WIFEXITED(status)) {
-    int exit = WEXITSTATUS(status);
+void Subprocess::ReleasePipes(vector<int>* fds) {
+  Stream* streams[] = { &stdout_, &stderr_ };
+  for (int i = 0; i < 2; ++i) {
+    if (streams[i]->fd_ < 0)
+      continue;
+    fds->push_back(streams[i]->fd_);
+    streams[i]->fd_ = -1;
+  }
+}
+
+bool Subprocess::DrainPipe(int fd) {
+  char buf[64 << 10];
+  ssize_t len = read(fd, buf, sizeof(buf));
+  return len > 0 || (len < 0 && (errno == EAGAIN || errno == EINTR));
+}
+
+void Subprocess::CloseStream(Stream* stream) {
+  // Children started since hold copies of the pipe until they exec,
+  // which would keep it registered past the close().
+  if (epoll_fd_ >= 0)
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, stream->fd_, NULL);
+  close(stream->fd_);
+  stream->fd_ = -1;
+}
+
+bool Subprocess::Finish() {
+  if (spawn_failed_)
+    return false;
+  if (pid_ != -1) {
+    if (wait4(pid_, &status_, 0, &rusage_) < 0)
+      Fatal("wait4(%d): %s", pid_, strerror(errno));
+    pid_ = -1;
+    if (pidfd_.fd_ >= 0)
+      CloseStream(&pidfd_);
+  }
+
+  if (WIFEXITED(status_)) {
+    int exit = WEXITSTATUS(status_);
     if (exit == 0)
       return true;
   }
   return false;
 }
 
+void Subprocess::Kill(int sig) {
+  // Until it's reaped the pid, and so its process group, can't have been
+  // reused.
+  if (pid_ != -1)
+    kill(-pid_, sig);
+}
+
+SubprocessSet::SubprocessSet() : wake_fd_(-1) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    Fatal("epoll_create1: %s", strerror(errno));
+}
+
+SubprocessSet::~SubprocessSet() {
+  for (vector<Subprocess::Stream*>::iterator i = leftovers_.begin();
+       i != leftovers_.end(); ++i) {
+    delete *i;
+  }
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+}
+
+void SubprocessSet::UsePoll() {
+  assert(running_.empty());
+  close(epoll_fd_);
+  epoll_fd_ = -1;
+}
+
 void SubprocessSet::Add(Subprocess* subprocess) {
+  subprocess->running_index_ = running_.size();
   running_.push_back(subprocess);
+  if (epoll_fd_ < 0)
+    return;
+
+  subprocess->epoll_fd_ = epoll_fd_;
+  Subprocess::Stream* streams[] = { &subprocess->stdout_,
+                                    &subprocess->stderr_,
+                                    &subprocess->pidfd_ };
+  for (int i = 0; i < 3; ++i) {
+    if (streams[i]->fd_ < 0)
+      continue;
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = streams[i];
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, streams[i]->fd_, &event) < 0)
+      Fatal("epoll_ctl: %s", strerror(errno));
+  }
+}
+
+bool SubprocessSet::DoWork(int wake_fd, int timeout_ms) {
+  if (epoll_fd_ < 0)
+    return DoWorkPoll(wake_fd, timeout_ms);
+  return DoWorkEpoll(wake_fd, timeout_ms);
+}
+
+bool SubprocessSet::DoWorkEpoll(int wake_fd, int timeout_ms) {
+  // Only watch the wake fd while asked to; it may stay readable.
+  if (wake_fd != wake_fd_) {
+    if (wake_fd_ >= 0)
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, wake_fd_, NULL);
+    wake_fd_ = -1;
+    if (wake_fd >= 0) {
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.ptr = NULL;
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd, &event) < 0)
+        Fatal("epoll_ctl: %s", strerror(errno));
+      wake_fd_ = wake_fd;
+    }
+  }
+
+  epoll_event events[64];
+  int ret = epoll_wait(epoll_fd_, events, 64, timeout_ms);
+  if (ret == -1) {
+    // A signal counts as a wake, so its handler's request is seen soon.
+    if (errno == EINTR)
+      return true;
+    perror("epoll_wait");
+    return false;
+  }
+  if (ret == 0)
+    return true;
+
+  bool woken = false;
+  for (int i = 0; i < ret; ++i) {
+    Subprocess::Stream* stream =
+        static_cast<Subprocess::Stream*>(events[i].data.ptr);
+    if (!stream) {
+      woken = true;
+      continue;
+    }
+    // Closed earlier in this batch, when its process exited.
+    if (stream->fd_ < 0)
+      continue;
+    if (!stream->owner_) {
+      DrainLeftover(stream);
+      continue;
+    }
+    Subprocess* subproc = stream->owner_;
+    subproc->OnFDReady(stream->fd_);
+    CheckFinished(subproc);
+  }
+  return woken;
 }
 
-void SubprocessSet::DoWork() {
+bool SubprocessSet::DoWorkPoll(int wake_fd, int timeout_ms) {
   vector<pollfd> fds;
 
-  map<int, Subprocess*> fd_to_subprocess;
+  map<int, Subprocess::Stream*> fd_to_stream;
   for (vector<Subprocess*>::iterator i = running_.begin();
        i != running_.end(); ++i) {
-    int fd = (*i)->stdout_.fd_;
-    if (fd >= 0) {
-      fd_to_subprocess[fd] = *i;
-      fds.resize(fds.size() + 1);
-      pollfd* newfd = &fds.back();
-      newfd->fd = fd;
-      newfd->events = POLLIN;
-      newfd->revents = 0;
-    }
-    fd = (*i)->stderr_.fd_;
-    if (fd >= 0) {
-      fd_to_subprocess[fd] = *i;
+    Subprocess::Stream* streams[] = { &(*i)->stdout_, &(*i)->stderr_,
+                                      &(*i)->pidfd_ };
+    for (int j = 0; j < 3; ++j) {
+      int fd = streams[j]->fd_;
+      if (fd < 0)
+        continue;
+      fd_to_stream[fd] = streams[j];
       fds.resize(fds.size() + 1);
       pollfd* newfd = &fds.back();
       newfd->fd = fd;
@@ -153,29 +384,86 @@ void SubprocessSet::DoWork() {
       newfd->revents = 0;
     }
   }
+  for (vector<Subprocess::Stream*>::iterator i = leftovers_.begin();
+       i != leftovers_.end(); ++i) {
+    fd_to_stream[(*i)->fd_] = *i;
+    pollfd pfd = { (*i)->fd_, POLLIN, 0 };
+    fds.push_back(pfd);
+  }
+
+  if (wake_fd >= 0) {
+    pollfd pfd = { wake_fd, POLLIN, 0 };
+    fds.push_back(pfd);
+  }
 
-  int ret = poll(fds.data(), fds.size(), -1);
+  int ret = poll(fds.data(), fds.size(), timeout_ms);
   if (ret == -1) {
-    if (errno != EINTR)
-      perror("poll");
-    return;
+    if (errno == EINTR)
+      return true;
+    perror("poll");
+    return false;
   }
+  if (ret == 0)
+    return true;
 
+  bool woken = false;
+  if (wake_fd >= 0) {
+    woken = fds.back().revents != 0;
+    fds.pop_back();
+  }
   for (size_t i = 0; i < fds.size(); ++i) {
-    if (fds[i].revents) {
-      Subprocess* subproc = fd_to_subprocess[fds[i].fd];
-      if (fds[i].revents) {
-        subproc->OnFDReady(fds[i].fd);
-        if (subproc->done()) {
-          finished_.push(subproc);
-          std::remove(running_.begin(), running_.end(), subproc);
-          running_.resize(running_.size() - 1);
-        }
+    Subprocess::Stream* stream = fd_to_stream[fds[i].fd];
+    // Skip pipes closed earlier in this batch, when their process exited.
+    if (fds[i].revents && stream->fd_ >= 0) {
+      if (!stream->owner_) {
+        DrainLeftover(stream);
+        continue;
       }
+      Subprocess* subproc = stream->owner_;
+      subproc->OnFDReady(fds[i].fd);
+      CheckFinished(subproc);
+    }
+  }
+  return woken;
+}
+
+void SubprocessSet::CheckFinished(Subprocess* subproc) {
+  if (!subproc->done())
+    return;
+  finished_.push(subproc);
+  // Move the last running subprocess into its place.
+  size_t index = subproc->running_index_;
+  Subprocess* last = running_.back();
+  running_[index] = last;
+  last->running_index_ = index;
+  running_.pop_back();
+  subproc->epoll_fd_ = -1;
+
+  vector<int> fds;
+  subproc->ReleasePipes(&fds);
+  for (vector<int>::iterator i = fds.begin(); i != fds.end(); ++i) {
+    Subprocess::Stream* stream = new Subprocess::Stream;
+    stream->fd_ = *i;
+    if (epoll_fd_ >= 0) {
+      epoll_event event;
+      event.events = EPOLLIN;
+      event.data.ptr = stream;
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, *i, &event) < 0)
+        Fatal("epoll_ctl: %s", strerror(errno));
     }
+    leftovers_.push_back(stream);
   }
 }
 
+void SubprocessSet::DrainLeftover(Subprocess::Stream* stream) {
+  if (Subprocess::DrainPipe(stream->fd_))
+    return;
+  if (epoll_fd_ >= 0)
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, stream->fd_, NULL);
+  leftovers_.erase(find(leftovers_.begin(), leftovers_.end(), stream));
+  delete stream;
+}
+
 Subprocess* SubprocessSet::NextFinished() {
   if (finished_.empty())
     return NULL;
@@ -12,45 +12,124 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <signal.h>
+#include <sys/resource.h>
+
 #include <string>
 #include <vector>
 #include <queue>
 using namespace std;
 
+// Split |command| into words if running it through /bin/sh would do no
+// more than that: no quoting, variables, redirections, globs, pipes or
+// other shell syntax, and not a shell builtin.  Returns false if the
+// command needs a shell.
+bool SplitCommand(const string& command, vector<string>* words);
+
 // Subprocess wraps a single async subprocess.  It is entirely
 // passive: it expects the caller to notify it when its fds are ready
 // for reading, as well as call Finish() to reap the child once done()
-// is true.
+// is true.  The child counts as done once it has exited, even if
+// something it left running still holds its output pipes; those are
+// then handed on with ReleasePipes().
 struct Subprocess {
   Subprocess();
   ~Subprocess();
-  bool Start(const string& command);
+  // Run |command|, through /bin/sh only if SplitCommand() says so.  With
+  // |merge_output|, stderr goes to the same pipe as stdout, which keeps
+  // their output in order and saves a pipe; stderr_ is then unused.
+  bool Start(const string& command, bool merge_output = false);
   void OnFDReady(int fd);
-  // Returns true on successful process exit.
+  // Returns true on successful process exit.  Fills in rusage_.
   bool Finish();
+  // Send |sig| to the child and everything in its process group; it
+  // still has to be finished as usual.
+  void Kill(int sig = SIGKILL);
 
   bool done() const {
-    return stdout_.fd_ == -1 && stderr_.fd_ == -1;
+    return pidfd_.fd_ == -1 &&
+        (exited_ || (stdout_.fd_ == -1 && stderr_.fd_ == -1));
   }
 
+  // Once done(), move whichever output pipes are still open into |fds|.
+  // Whoever takes them must read them until EOF before closing them, so
+  // that what the child left running doesn't get SIGPIPE on its next
+  // write.
+  void ReleasePipes(vector<int>* fds);
+  // Read and throw away whatever is waiting in |fd|, one of those pipes.
+  // Returns false once it is at EOF.
+  static bool DrainPipe(int fd);
+
   struct Stream {
     Stream();
     ~Stream();
     int fd_;
     string buf_;
+    Subprocess* owner_;
   };
   Stream stdout_, stderr_;
+  // Not a stream, but watched like one: a pidfd for the child, readable
+  // once it exits.  -1 once it has been reaped, or if the kernel doesn't
+  // have pidfds, in which case we wait for the pipes to close instead.
+  Stream pidfd_;
   pid_t pid_;
+  // The child's wait status, once it has been reaped.
+  int status_;
+  // Set once the pidfd said the child exited and it was reaped.
+  bool exited_;
+  // Set if the child couldn't be started; stderr_ says why.
+  bool spawn_failed_;
+  // Whether the command ran under /bin/sh, rather than directly.
+  bool used_shell_;
+  // Resources used by the child (and the children it waited for).
+  struct rusage rusage_;
+
+  // The epoll instance the pipes are registered with, if any, and where
+  // this is in its SubprocessSet's running_ list.
+  int epoll_fd_;
+  size_t running_index_;
+
+private:
+  // Reap the exited child and take whatever output is already waiting,
+  // without waiting for its pipes to reach EOF.
+  void OnExit();
+  void CloseStream(Stream* stream);
 };
 
-// SubprocessSet runs a poll() loop around a set of Subprocesses.
+// SubprocessSet runs an epoll loop around a set of Subprocesses.
 // DoWork() waits for any state change in subprocesses; finished_
 // is a queue of subprocesses as they finish.
 struct SubprocessSet {
+  SubprocessSet();
+  ~SubprocessSet();
+  // Wait with poll() instead, building the list of fds on every call.
+  // Only for comparison; must be called before adding anything.
+  void UsePoll();
+
   void Add(Subprocess* subprocess);
-  void DoWork();
+  // Also stop waiting if |wake_fd| (if >= 0) becomes readable, after
+  // |timeout_ms| (if >= 0) or when a signal arrives; returns true if any
+  // of those happened.
+  bool DoWork(int wake_fd = -1, int timeout_ms = -1);
   Subprocess* NextFinished();
 
   vector<Subprocess*> running_;
   queue<Subprocess*> finished_;
+
+private:
+  bool DoWorkEpoll(int wake_fd, int timeout_ms);
+  bool DoWorkPoll(int wake_fd, int timeout_ms);
+  // Record |subproc| as finished if it just became done().
+  void CheckFinished(Subprocess* subproc);
+  // Read from |stream|, one of leftovers_, and drop it at EOF.
+  void DrainLeftover(Subprocess::Stream* stream);
+
+  // Every running subprocess's pipes are registered with epoll_fd_ when
+  // they are added, with their Stream as the event data, and the
+  // DoWork() wake fd while it is being waited on.  -1 if polling.
+  int epoll_fd_;
+  int wake_fd_;
+  // Pipes of finished subprocesses that something they left running
+  // still holds, read until EOF and thrown away.  They have no owner_.
+  vector<Subprocess::Stream*> leftovers_;
 };
@@ -0,0 +1,154 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures what SubprocessSet::DoWork() costs per wakeup with many
+// children running at once, with epoll and with poll(), and how fast
+// commands launch as ninja's memory grows.
+// Usage: subprocess_perftest [children]
+//        subprocess_perftest spawn [max_rss_mb]
+// In the first form each child prints a line to stdout and to stderr
+// every 50ms for a second, so every wakeup happens with (nearly) all of
+// them still running.  The
+// second runs "true" over and over, with Subprocess and with plain
+// fork() and exec, while holding more and more memory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "subprocess.h"
+#include "util.h"
+
+namespace {
+
+double CpuMs(const rusage& ru) {
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+void Run(const char* name, int children, bool use_poll, bool merge) {
+  SubprocessSet subprocs;
+  if (use_poll)
+    subprocs.UsePoll();
+  for (int i = 0; i < children; ++i) {
+    Subprocess* subproc = new Subprocess;
+    subproc->Start("for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 "
+                   "19 20; do echo $i; echo $i >&2; sleep 0.05; done",
+                   merge);
+    subprocs.Add(subproc);
+  }
+
+  // Only count the time spent in DoWork(), not starting the children.
+  int wakeups = 0;
+  double cpu_ms = 0;
+  while (!subprocs.running_.empty()) {
+    rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    subprocs.DoWork();
+    getrusage(RUSAGE_SELF, &after);
+    cpu_ms += CpuMs(after) - CpuMs(before);
+    ++wakeups;
+  }
+  while (Subprocess* subproc = subprocs.NextFinished()) {
+    subproc->Finish();
+    delete subproc;
+  }
+  printf("%-12s %d children: %6d wakeups, %8.1fms CPU, %6.1fus/wakeup\n",
+         name, children, wakeups, cpu_ms, cpu_ms * 1e3 / wakeups);
+}
+
+double Now() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void LaunchWithSubprocess() {
+  Subprocess subproc;
+  subproc.Start("true");
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (!subproc.done())
+    subprocs.DoWork();
+  subproc.Finish();
+  subprocs.running_.clear();
+}
+
+// What Subprocess::Start() used to do.
+void LaunchWithFork() {
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    execl("/bin/sh", "/bin/sh", "-c", "true", NULL);
+    _exit(1);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+}
+
+double LaunchesPerSecond(void (*launch)()) {
+  const int kLaunches = 200;
+  double start = Now();
+  for (int i = 0; i < kLaunches; ++i)
+    launch();
+  return kLaunches / (Now() - start);
+}
+
+void Spawn(int max_rss_mb) {
+  vector<char*> blocks;
+  int rss_mb = 0;
+  for (int target = 0; target <= max_rss_mb;
+       target = target ? target * 2 : 256) {
+    // Grow to the target in touched 64MB blocks, like a loaded graph.
+    for (; rss_mb < target; rss_mb += 64) {
+      char* block = static_cast<char*>(malloc(64 << 20));
+      memset(block, 1, 64 << 20);
+      blocks.push_back(block);
+    }
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double spawned = LaunchesPerSecond(LaunchWithSubprocess);
+    double forked = LaunchesPerSecond(LaunchWithFork);
+    printf("rss %5ldMB: posix_spawn %6.0f/s, fork %6.0f/s\n",
+           ru.ru_maxrss / 1024, spawned, forked);
+  }
+  for (size_t i = 0; i < blocks.size(); ++i)
+    free(blocks[i]);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "spawn") == 0) {
+    Spawn(argc > 2 ? atoi(argv[2]) : 2048);
+    return 0;
+  }
+
+  int children = argc > 1 ? atoi(argv[1]) : 1000;
+
+  // Up to two pipes and a pidfd per child.
+  RaiseOpenFileLimit();
+
+  Run("poll", children, true, false);
+  Run("epoll", children, false, false);
+  Run("epoll merged", children, false, true);
+  return 0;
+}
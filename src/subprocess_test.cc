@@ -14,6 +14,14 @@
 
 #include "subprocess.h"
 
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "test.h"
 
 TEST(Subprocess, Ls) {
@@ -94,3 +102,291 @@ TEST(SubprocessSet, Multi) {
   }
 }
 
+
+TEST(SubprocessSet, Timeout) {
+  SubprocessSet subprocs;
+  Subprocess* sleeper = new Subprocess;
+  EXPECT_TRUE(sleeper->Start("sleep 0.3"));
+  subprocs.Add(sleeper);
+
+  // Nothing happens within the timeout.
+  EXPECT_TRUE(subprocs.DoWork(-1, 10));
+  EXPECT_FALSE(sleeper->done());
+
+  while (!sleeper->done())
+    EXPECT_FALSE(subprocs.DoWork(-1, 10000));
+  EXPECT_TRUE(sleeper->Finish());
+  delete subprocs.NextFinished();
+}
+
+TEST(SubprocessSet, FinishOutOfOrder) {
+  for (int use_poll = 0; use_poll < 2; ++use_poll) {
+    SubprocessSet subprocs;
+    if (use_poll)
+      subprocs.UsePoll();
+    const char* kCommands[3] = {
+      "sleep 0.2; echo a",
+      "echo b",
+      "sleep 0.1; echo c >&2",
+    };
+    for (int i = 0; i < 3; ++i) {
+      Subprocess* subproc = new Subprocess;
+      EXPECT_TRUE(subproc->Start(kCommands[i]));
+      subprocs.Add(subproc);
+    }
+
+    // Removing a finished subprocess from the middle keeps the rest.
+    string order;
+    while (!subprocs.running_.empty()) {
+      subprocs.DoWork();
+      while (Subprocess* subproc = subprocs.NextFinished()) {
+        EXPECT_TRUE(subproc->Finish());
+        order += subproc->stdout_.buf_ + subproc->stderr_.buf_;
+        delete subproc;
+      }
+    }
+    EXPECT_EQ("b\nc\na\n", order);
+  }
+}
+
+TEST(Subprocess, SplitCommand) {
+  vector<string> words;
+  EXPECT_TRUE(SplitCommand("  cc -c  foo.c\t-o out/foo.o -DX=1 ", &words));
+  ASSERT_EQ(6u, words.size());
+  EXPECT_EQ("cc", words[0]);
+  EXPECT_EQ("foo.c", words[2]);
+  EXPECT_EQ("-DX=1", words[5]);
+
+  const char* kNeedShell[] = {
+    "", "cc foo.c > foo.o", "cat a | wc", "a && b", "a; b", "echo $HOME",
+    "cc \"foo bar.c\"", "cc 'x'", "ls *.c", "cd dir", "exit 1",
+    "X=1 cc foo.c", "echo a\\ b", "cc foo.c # comment", "ls ~",
+    "echo `pwd`", "a\nb", "if true", ". ./env",
+  };
+  for (size_t i = 0; i < sizeof(kNeedShell) / sizeof(kNeedShell[0]); ++i)
+    EXPECT_FALSE(SplitCommand(kNeedShell[i], &words)) << kNeedShell[i];
+}
+
+TEST(Subprocess, Direct) {
+  Subprocess subproc;
+  EXPECT_TRUE(subproc.Start("printf %s-%s a b"));
+  EXPECT_FALSE(subproc.used_shell_);
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (!subproc.done())
+    subprocs.DoWork();
+  EXPECT_TRUE(subproc.Finish());
+  EXPECT_EQ("a-b", subproc.stdout_.buf_);
+  subprocs.NextFinished();
+}
+
+TEST(Subprocess, DirectNotFound) {
+  Subprocess subproc;
+  EXPECT_TRUE(subproc.Start("ninja_no_such_command --flag"));
+  EXPECT_FALSE(subproc.used_shell_);
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (!subproc.done())
+    subprocs.DoWork();
+  EXPECT_FALSE(subproc.Finish());
+  EXPECT_EQ("ninja_no_such_command: No such file or directory",
+            subproc.stderr_.buf_);
+  subprocs.NextFinished();
+}
+
+TEST(Subprocess, DirectScriptWithoutInterpreter) {
+  char path[] = "/tmp/ninja_subprocess_test-XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(8, write(fd, "echo hi\n", 8));
+  close(fd);
+  chmod(path, 0755);
+
+  // Like the shell, run it as a shell script.
+  Subprocess subproc;
+  EXPECT_TRUE(subproc.Start(path));
+  EXPECT_TRUE(subproc.used_shell_);
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (!subproc.done())
+    subprocs.DoWork();
+  EXPECT_TRUE(subproc.Finish());
+  EXPECT_EQ("hi\n", subproc.stdout_.buf_);
+  subprocs.NextFinished();
+  unlink(path);
+}
+
+// A command that leaves something running with its output pipes is done
+// when it exits, with the output it wrote.
+TEST(SubprocessSet, BackgroundProcessHoldsPipes) {
+  for (int use_poll = 0; use_poll < 2; ++use_poll) {
+    SubprocessSet subprocs;
+    if (use_poll)
+      subprocs.UsePoll();
+    Subprocess* subproc = new Subprocess;
+    EXPECT_TRUE(subproc->Start("sleep 3 & echo started; exit 2"));
+    if (subproc->pidfd_.fd_ < 0) {
+      // No pidfds; we'd wait for the sleep.
+      delete subproc;
+      return;
+    }
+    subprocs.Add(subproc);
+
+    timeval start, end;
+    gettimeofday(&start, NULL);
+    while (!subproc->done())
+      subprocs.DoWork();
+    gettimeofday(&end, NULL);
+    EXPECT_LT(end.tv_sec - start.tv_sec, 2);
+
+    EXPECT_EQ(subproc, subprocs.NextFinished());
+    EXPECT_FALSE(subproc->Finish());
+    EXPECT_EQ(2, WEXITSTATUS(subproc->status_));
+    EXPECT_EQ("started\n", subproc->stdout_.buf_);
+    delete subproc;
+  }
+}
+
+// What a command leaves running can still write to its pipes after the
+// command is done, instead of getting SIGPIPE or EPIPE.
+TEST(SubprocessSet, BackgroundProcessKeepsWriting) {
+  for (int use_poll = 0; use_poll < 2; ++use_poll) {
+    char path[] = "/tmp/ninja_subprocess_test-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    unlink(path);
+
+    SubprocessSet subprocs;
+    if (use_poll)
+      subprocs.UsePoll();
+    Subprocess* subproc = new Subprocess;
+    string command = "(trap '' PIPE; sleep 0.2; echo late; echo $? > ";
+    command += path;
+    command += ") & exit 0";
+    EXPECT_TRUE(subproc->Start(command));
+    subprocs.Add(subproc);
+    while (!subproc->done())
+      subprocs.DoWork();
+    EXPECT_EQ(subproc, subprocs.NextFinished());
+    EXPECT_TRUE(subproc->Finish());
+    delete subproc;
+
+    // Keep the set going until the background process has written.
+    struct stat st;
+    for (int i = 0; i < 50 && stat(path, &st) < 0; ++i)
+      subprocs.DoWork(-1, 100);
+    FILE* f = fopen(path, "r");
+    ASSERT_TRUE(f != NULL);
+    char status[16] = "";
+    fgets(status, sizeof(status), f);
+    fclose(f);
+    EXPECT_STREQ("0\n", status);
+    unlink(path);
+  }
+}
+
+TEST(Subprocess, MergeOutput) {
+  Subprocess subproc;
+  EXPECT_TRUE(subproc.Start("echo 1; echo 2 >&2; echo 3", true));
+  EXPECT_EQ(-1, subproc.stderr_.fd_);
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (!subproc.done())
+    subprocs.DoWork();
+  EXPECT_TRUE(subproc.Finish());
+  // In the order it was written.
+  EXPECT_EQ("1\n2\n3\n", subproc.stdout_.buf_);
+  EXPECT_EQ("", subproc.stderr_.buf_);
+  subprocs.NextFinished();
+}
+
+TEST(Subprocess, CloseOnExec) {
+  Subprocess first;
+  EXPECT_TRUE(first.Start("sleep 0.2", true));
+  // A later command doesn't get the first one's pipe.
+  char command[64];
+  snprintf(command, sizeof(command), "test -e /proc/self/fd/%d",
+           first.stdout_.fd_);
+  Subprocess second;
+  EXPECT_TRUE(second.Start(command, true));
+  SubprocessSet subprocs;
+  subprocs.Add(&first);
+  subprocs.Add(&second);
+  while (!first.done() || !second.done())
+    subprocs.DoWork();
+  EXPECT_TRUE(first.Finish());
+  EXPECT_FALSE(second.Finish());
+}
+
+// Commands get the default SIGPIPE even when we ignore it, as
+// ninja_worker does.
+TEST(Subprocess, DefaultSigpipe) {
+  signal(SIGPIPE, SIG_IGN);
+  Subprocess subproc;
+  EXPECT_TRUE(subproc.Start("yes | head -1", true));
+  signal(SIGPIPE, SIG_DFL);
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (!subproc.done())
+    subprocs.DoWork();
+  EXPECT_TRUE(subproc.Finish());
+  // yes is killed quietly instead of complaining about a broken pipe.
+  EXPECT_EQ("y\n", subproc.stdout_.buf_);
+  subprocs.NextFinished();
+}
+
+TEST(Subprocess, Kill) {
+  Subprocess subproc;
+  EXPECT_TRUE(subproc.Start("echo started; exec sleep 10"));
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (subproc.stdout_.buf_.empty())
+    subprocs.DoWork();
+  subproc.Kill();
+  while (!subproc.done())
+    subprocs.DoWork();
+  EXPECT_FALSE(subproc.Finish());
+  EXPECT_TRUE(WIFSIGNALED(subproc.status_));
+  EXPECT_EQ(SIGKILL, WTERMSIG(subproc.status_));
+  // Killing it again, once reaped, does nothing.
+  subproc.Kill();
+  subprocs.NextFinished();
+}
+
+// Kill() also reaches what a shell command started.
+TEST(Subprocess, KillShellCommand) {
+  Subprocess subproc;
+  EXPECT_TRUE(subproc.Start("sleep 10 & echo $!; wait"));
+  EXPECT_TRUE(subproc.used_shell_);
+  SubprocessSet subprocs;
+  subprocs.Add(&subproc);
+  while (subproc.stdout_.buf_.empty())
+    subprocs.DoWork();
+  pid_t sleep_pid = atoi(subproc.stdout_.buf_.c_str());
+  ASSERT_GT(sleep_pid, 0);
+  subproc.Kill();
+  while (!subproc.done())
+    subprocs.DoWork();
+  EXPECT_FALSE(subproc.Finish());
+  subprocs.NextFinished();
+
+  // The sleep is gone, or a zombie waiting for init to reap it.
+  bool gone = false;
+  for (int i = 0; i < 100 && !gone; ++i) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", sleep_pid);
+    FILE* f = fopen(path, "r");
+    if (!f) {
+      gone = true;
+      break;
+    }
+    char state = 0;
+    fscanf(f, "%*d %*s %c", &state);
+    fclose(f);
+    gone = state == 'Z';
+    if (!gone)
+      usleep(10000);
+  }
+  EXPECT_TRUE(gone);
+}
@@ -0,0 +1,177 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+namespace {
+
+// Append |str| to |out| as a quoted JSON string.
+void AppendJsonString(const string& str, string* out) {
+  out->push_back('"');
+  for (string::const_iterator i = str.begin(); i != str.end(); ++i) {
+    unsigned char c = *i;
+    switch (c) {
+    case '"':  out->append("\\\""); break;
+    case '\\': out->append("\\\\"); break;
+    case '\n': out->append("\\n"); break;
+    case '\t': out->append("\\t"); break;
+    default:
+      if (c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out->append(buf);
+      } else {
+        out->push_back(c);
+      }
+    }
+  }
+  out->push_back('"');
+}
+
+// Orders command events by start time, for track assignment.
+struct StartsBefore {
+  StartsBefore(const vector<Trace::Event>& events) : events_(events) {}
+  bool operator()(int a, int b) const {
+    return events_[a].start_us < events_[b].start_us;
+  }
+  const vector<Trace::Event>& events_;
+};
+
+}  // anonymous namespace
+
+Trace::Trace() {
+  gettimeofday(&start_, NULL);
+}
+
+long long Trace::Now() const {
+  timeval now;
+  gettimeofday(&now, NULL);
+  return ToTraceTime(now);
+}
+
+long long Trace::ToTraceTime(const timeval& tv) const {
+  return (tv.tv_sec - start_.tv_sec) * 1000000LL +
+      (tv.tv_usec - start_.tv_usec);
+}
+
+void Trace::AddPhase(const string& name, long long start_us,
+                     long long end_us) {
+  Event event;
+  event.name = name;
+  event.start_us = start_us;
+  event.end_us = end_us;
+  event.track = 0;
+  event.is_command = false;
+  events_.push_back(event);
+}
+
+void Trace::AddCommand(const string& name, const string& detail,
+                       long long start_us, long long end_us) {
+  Event event;
+  event.name = name;
+  event.detail = detail;
+  event.start_us = start_us;
+  event.end_us = end_us;
+  event.track = 0;
+  event.is_command = true;
+  events_.push_back(event);
+}
+
+int Trace::AssignTracks() {
+  vector<int> commands;
+  for (size_t i = 0; i < events_.size(); ++i) {
+    if (events_[i].is_command)
+      commands.push_back(i);
+  }
+  stable_sort(commands.begin(), commands.end(), StartsBefore(events_));
+
+  // Tracks in use, by the time they become free, and idle tracks.
+  typedef pair<long long, int> Busy;
+  priority_queue<Busy, vector<Busy>, greater<Busy> > busy;
+  priority_queue<int, vector<int>, greater<int> > idle;
+  int tracks = 0;
+  for (vector<int>::iterator i = commands.begin(); i != commands.end(); ++i) {
+    Event* event = &events_[*i];
+    while (!busy.empty() && busy.top().first <= event->start_us) {
+      idle.push(busy.top().second);
+      busy.pop();
+    }
+    if (idle.empty()) {
+      event->track = ++tracks;
+    } else {
+      event->track = idle.top();
+      idle.pop();
+    }
+    busy.push(make_pair(event->end_us, event->track));
+  }
+  return tracks;
+}
+
+bool Trace::Write(const string& path, string* err) {
+  int tracks = AssignTracks();
+
+  string out = "{\"traceEvents\":[\n";
+  char buf[128];
+  // Name the tracks: 0 is ninja itself, the rest are job slots.
+  out.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+             "\"args\":{\"name\":\"ninja\"}}");
+  for (int i = 1; i <= tracks; ++i) {
+    snprintf(buf, sizeof(buf),
+             ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+             "\"tid\":%d,\"args\":{\"name\":\"slot %d\"}}", i, i);
+    out.append(buf);
+  }
+
+  for (vector<Event>::iterator i = events_.begin(); i != events_.end(); ++i) {
+    out.append(",\n{\"name\":");
+    AppendJsonString(i->name, &out);
+    snprintf(buf, sizeof(buf),
+             ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+             "\"pid\":0,\"tid\":%d",
+             i->is_command ? "command" : "ninja", i->start_us,
+             i->end_us - i->start_us, i->track);
+    out.append(buf);
+    if (!i->detail.empty()) {
+      out.append(",\"args\":{\"command\":");
+      AppendJsonString(i->detail, &out);
+      out.append("}");
+    }
+    out.append("}");
+  }
+  out.append("\n]}\n");
+
+  FILE* f = fopen(path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+  if (fwrite(out.data(), 1, out.size(), f) != out.size()) {
+    *err = strerror(errno);
+    fclose(f);
+    return false;
+  }
+  if (fclose(f) != 0) {
+    *err = strerror(errno);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,77 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_TRACE_H_
+#define NINJA_TRACE_H_
+
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+// Trace collects a timeline of a ninja run -- ninja's own phases plus
+// every command it ran -- and writes it in the Trace Event JSON format
+// understood by chrome://tracing and Perfetto.
+struct Trace {
+  Trace();
+
+  // Microseconds since the trace was created.
+  long long Now() const;
+  // Convert a gettimeofday() result to trace time.
+  long long ToTraceTime(const timeval& tv) const;
+
+  // Record one of ninja's own phases (parsing, loading the log, ...).
+  void AddPhase(const string& name, long long start_us, long long end_us);
+  // Record a command.  |detail| (e.g. the command line) is shown when the
+  // slice is selected.
+  void AddCommand(const string& name, const string& detail,
+                  long long start_us, long long end_us);
+
+  // Write the trace to |path|.  Commands are laid out one track per
+  // concurrency slot: each goes to the lowest-numbered track that is idle
+  // when it starts, so the number of tracks is the peak parallelism.
+  bool Write(const string& path, string* err);
+
+  struct Event {
+    string name;
+    string detail;
+    long long start_us, end_us;
+    // 0 for phases, otherwise the command's track (filled in by Write).
+    int track;
+    bool is_command;
+  };
+  // Assign a track to every command event; returns the number of tracks.
+  int AssignTracks();
+
+  timeval start_;
+  vector<Event> events_;
+};
+
+// Records a phase covering the lifetime of the object.  |trace| may be
+// NULL, in which case nothing is recorded.
+struct ScopedTracePhase {
+  ScopedTracePhase(Trace* trace, const char* name)
+      : trace_(trace), name_(name), start_us_(trace ? trace->Now() : 0) {}
+  ~ScopedTracePhase() {
+    if (trace_)
+      trace_->AddPhase(name_, start_us_, trace_->Now());
+  }
+
+  Trace* trace_;
+  const char* name_;
+  long long start_us_;
+};
+
+#endif  // NINJA_TRACE_H_
@@ -0,0 +1,70 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <gtest/gtest.h>
+
+#include "ninja.h"
+
+static const char kTestFilename[] = "TraceTest-tempfile";
+
+TEST(Trace, AssignTracks) {
+  Trace trace;
+  trace.AddCommand("a", "", 0, 100);
+  trace.AddCommand("b", "", 10, 50);
+  trace.AddCommand("c", "", 50, 80);   // Reuses b's track.
+  trace.AddCommand("d", "", 60, 120);  // a and c are still running.
+  trace.AddCommand("e", "", 100, 110); // a's track is free again.
+  trace.AddPhase("parse", 0, 5);
+
+  EXPECT_EQ(3, trace.AssignTracks());
+  EXPECT_EQ(1, trace.events_[0].track);
+  EXPECT_EQ(2, trace.events_[1].track);
+  EXPECT_EQ(2, trace.events_[2].track);
+  EXPECT_EQ(3, trace.events_[3].track);
+  EXPECT_EQ(1, trace.events_[4].track);
+  EXPECT_EQ(0, trace.events_[5].track);
+}
+
+TEST(Trace, Write) {
+  Trace trace;
+  trace.AddPhase("manifest parse", 0, 5);
+  trace.AddCommand("CC \"quoted\"", "cc a\\b.c", 5, 25);
+
+  string err;
+  ASSERT_TRUE(trace.Write(kTestFilename, &err));
+  string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  unlink(kTestFilename);
+
+  EXPECT_EQ(
+"{\"traceEvents\":[\n"
+"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+"\"args\":{\"name\":\"ninja\"}},\n"
+"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,"
+"\"args\":{\"name\":\"slot 1\"}},\n"
+"{\"name\":\"manifest parse\",\"cat\":\"ninja\",\"ph\":\"X\",\"ts\":0,"
+"\"dur\":5,\"pid\":0,\"tid\":0},\n"
+"{\"name\":\"CC \\\"quoted\\\"\",\"cat\":\"command\",\"ph\":\"X\",\"ts\":5,"
+"\"dur\":20,\"pid\":0,\"tid\":1,\"args\":{\"command\":\"cc a\\\\b.c\"}}\n"
+"]}\n", contents);
+}
+
+TEST(Trace, WriteError) {
+  Trace trace;
+  string err;
+  EXPECT_FALSE(trace.Write("/nonexistent/dir/trace.json", &err));
+  EXPECT_FALSE(err.empty());
+}
@@ -15,9 +15,12 @@
 #include "util.h"
 
 #include <execinfo.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
 
 void DumpBacktrace(int skip_frames) {
   void* stack[256];
@@ -36,3 +39,66 @@ void Fatal(const char* msg, ...) {
   DumpBacktrace(1);
   exit(1);
 }
+
+bool g_explaining = false;
+bool g_show_stats = false;
+
+void Explain(const char* msg, ...) {
+  va_list ap;
+  fprintf(stderr, "ninja explain: ");
+  va_start(ap, msg);
+  vfprintf(stderr, msg, ap);
+  va_end(ap);
+  fprintf(stderr, "\n");
+}
+
+double GetLoadAverage() {
+  double loadavg[1];
+  if (getloadavg(loadavg, 1) != 1)
+    return -1;
+  return loadavg[0];
+}
+
+double GetPressure(const char* resource) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+  FILE* f = fopen(path, "r");
+  if (!f)
+    return -1;
+  // The first line reads "some avg10=1.23 avg60=... avg300=... total=...".
+  double avg10 = -1;
+  char buf[256];
+  if (fgets(buf, sizeof(buf), f) && strncmp(buf, "some ", 5) == 0) {
+    const char* avg = strstr(buf, "avg10=");
+    if (avg)
+      avg10 = atof(avg + 6);
+  }
+  fclose(f);
+  return avg10;
+}
+
+string ElideMiddle(const string& str, size_t width) {
+  const char kMargin[] = "...";
+  const size_t margin = sizeof(kMargin) - 1;
+  if (str.size() <= width)
+    return str;
+  if (width <= margin)
+    return str.substr(0, width);
+  size_t keep = width - margin;
+  size_t head = keep / 2;
+  return str.substr(0, head) + kMargin +
+         str.substr(str.size() - (keep - head));
+}
+
+int RaiseOpenFileLimit() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+    return -1;
+  if (limit.rlim_cur < limit.rlim_max) {
+    rlim_t old = limit.rlim_cur;
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+      limit.rlim_cur = old;
+  }
+  return limit.rlim_cur > INT_MAX ? INT_MAX : limit.rlim_cur;
+}
@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <string>
+using namespace std;
+
 // Dump a backtrace to stderr.
 // |skip_frames| is how many frames to skip;
 // DumpBacktrace implicitly skips itself already.
@@ -19,3 +22,30 @@ void DumpBacktrace(int skip_frames);
 
 // Log a fatal message, dump a backtrace, and exit.
 void Fatal(const char* msg, ...);
+
+// Set by "-d explain": print why each output is considered dirty.
+extern bool g_explaining;
+
+// Set by "-d stats": print statistics about the build at the end.
+extern bool g_show_stats;
+
+// Print "ninja explain: <msg>" to stderr.  Use EXPLAIN() so that the
+// arguments aren't even evaluated when explaining is off.
+void Explain(const char* msg, ...);
+#define EXPLAIN(...) do { if (g_explaining) Explain(__VA_ARGS__); } while (0)
+
+// Return the 1-minute system load average, or -1 if it is unavailable.
+double GetLoadAverage();
+
+// Return the share of the last 10 seconds in which some task was stalled
+// on |resource| ("cpu", "memory" or "io"), as a percentage, according to
+// Linux pressure stall information.  Returns -1 if PSI is unavailable.
+double GetPressure(const char* resource);
+
+// Shorten |str| to at most |width| characters by replacing its middle
+// with "...", keeping both ends, which usually say the most.
+string ElideMiddle(const string& str, size_t width);
+
+// Raise the limit on open files as far as we're allowed to, since every
+// running command needs a few.  Returns the new limit.
+int RaiseOpenFileLimit();
@@ -0,0 +1,31 @@
+// Copyright 2011 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util.h"
+
+#include <gtest/gtest.h>
+
+TEST(ElideMiddle, NothingToElide) {
+  EXPECT_EQ("", ElideMiddle("", 0));
+  EXPECT_EQ("Nothing to elide.", ElideMiddle("Nothing to elide.", 80));
+  EXPECT_EQ("Exactly", ElideMiddle("Exactly", 7));
+}
+
+TEST(ElideMiddle, ElideInTheMiddle) {
+  EXPECT_EQ("CC bui...raph.cc", ElideMiddle("CC build/src/graph.cc", 16));
+  EXPECT_EQ(16u, ElideMiddle("CC build/src/graph.cc", 16).size());
+  EXPECT_EQ("C...c", ElideMiddle("CC build/src/graph.cc", 5));
+  // No room for both ends.
+  EXPECT_EQ("CC", ElideMiddle("CC build/src/graph.cc", 2));
+}